@@ -10,14 +10,10 @@ int main(int argc, char *argv[])
     auto decoder = mapbox::geobuf::Decoder();
     auto bytes = argc > 1 ? mapbox::geobuf::load_bytes(argv[1])
                           : mapbox::geobuf::load_bytes();
-    auto geojson = decoder.decode(bytes);
+    // streamed, the decoded geojson is never held in memory
     if (argc > 2) {
-        return mapbox::geobuf::dump_bytes(argv[2],
-                                          mapbox::geojson::stringify(geojson))
-                   ? 0
-                   : -1;
+        return decoder.decode_to_json(bytes, std::string(argv[2])) ? 0 : -1;
     } else {
-        std::cout << mapbox::geojson::stringify(geojson);
+        return decoder.decode_to_json(bytes, stdout) ? 0 : -1;
     }
-    return 0;
 }
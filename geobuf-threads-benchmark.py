@@ -0,0 +1,71 @@
+import argparse
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from pybind11_geobuf import Decoder, Encoder
+
+
+def sample_features(n: int):
+    return {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "properties": {"index": i, "name": f"feature #{i}"},
+                "geometry": {
+                    "type": "LineString",
+                    "coordinates": [
+                        [120.0 + j * 1e-3, 30.0 + i * 1e-3] for j in range(50)
+                    ],
+                },
+            }
+            for i in range(n)
+        ],
+    }
+
+
+def timeit(work, *, threads: int, tasks: int):
+    with ThreadPoolExecutor(max_workers=threads) as executor:
+        tic = time.time()
+        list(executor.map(work, range(tasks)))
+        return time.time() - tic
+
+
+def benchmark(*, features: int, tasks: int, max_threads: int):
+    fc = Decoder().decode_to_geojson(Encoder().encode(sample_features(features)))
+    encoded = Encoder().encode(fc)
+
+    # one encoder/decoder per task (a shared one runs a call at a time)
+    def encode(_):
+        Encoder().encode(fc)
+
+    def decode(_):
+        Decoder().decode(encoded)
+
+    for name, work in [("encode", encode), ("decode", decode)]:
+        baseline = timeit(work, threads=1, tasks=tasks)
+        print(f"{name}, 1 thread: {baseline:.3f}s for {tasks} tasks")
+        threads = 2
+        while threads <= max_threads:
+            elapsed = timeit(work, threads=threads, tasks=tasks)
+            print(
+                f"{name}, {threads} threads: {elapsed:.3f}s "
+                f"(x{baseline / elapsed:.2f})"
+            )
+            threads *= 2
+
+
+if __name__ == "__main__":
+    prog = f"python3 {sys.argv[0]}"
+    description = "encode/decode on N Python threads vs. one (GIL released)"
+    parser = argparse.ArgumentParser(prog=prog, description=description)
+    parser.add_argument("--features", type=int, default=1000)
+    parser.add_argument("--tasks", type=int, default=32)
+    parser.add_argument("--max-threads", type=int, default=8)
+    args = parser.parse_args()
+    benchmark(
+        features=args.features,
+        tasks=args.tasks,
+        max_threads=args.max_threads,
+    )
@@ -38,12 +38,13 @@ def json2geobuf(
     output_path: str,
     *,
     precision: int = 8,
+    threads: int = 1,
 ):
     logger.info(
         f"geobuf encoding {input_path} ({__filesize(input_path):,} bytes)..."
     )  # noqa
     os.makedirs(os.path.dirname(os.path.abspath(output_path)), exist_ok=True)
-    encoder = Encoder(max_precision=int(10**precision))
+    encoder = Encoder(max_precision=int(10**precision), threads=threads)
     assert encoder.encode(
         geojson=input_path,
         geobuf=output_path,
@@ -1,7 +1,10 @@
 #include "geobuf/geobuf.hpp"
+#include "geobuf/kernels.hpp"
 #include "geobuf/pbf_decoder.cpp"
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <mapbox/geojson_impl.hpp>
 #include <mapbox/geojson_value_impl.hpp>
 
@@ -10,8 +13,25 @@
 #include "rapidjson/filewritestream.h"
 #include "rapidjson/prettywriter.h"
 #include "rapidjson/stringbuffer.h"
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include <cmath>
 #include <protozero/pbf_builder.hpp>
@@ -30,6 +50,7 @@ constexpr const auto RJFLAGS = rapidjson::kParseDefaultFlags |      //
                                rapidjson::kParseTrailingCommasFlag;
 constexpr uint32_t dimXY = 2;
 constexpr uint32_t dimXYZ = 3;
+constexpr int MIN_FEATURES_PER_THREAD = 256;
 
 using RapidjsonDocument = mapbox::geojson::rapidjson_document;
 using RapidjsonAllocator = mapbox::geojson::rapidjson_allocator;
@@ -60,6 +81,23 @@ RapidjsonValue load_json(const std::string &path)
 }
 RapidjsonValue load_json() { return load_json(stdin); }
 
+std::shared_ptr<RapidjsonValue> load_json_insitu(const std::string &path)
+{
+    struct Insitu
+    {
+        explicit Insitu(const std::string &path) : file(path, true) {}
+        MappedFile file;
+        RapidjsonValue json; // destroyed before the file is unmapped
+    };
+    auto insitu = std::make_shared<Insitu>(path);
+    if (insitu->file) {
+        RapidjsonDocument d;
+        d.ParseInsitu<RJFLAGS>(insitu->file.data());
+        insitu->json = RapidjsonValue{std::move(d.Move())};
+    }
+    return std::shared_ptr<RapidjsonValue>(insitu, &insitu->json);
+}
+
 // note that fp will be closed from inside after writing!
 bool dump_json(FILE *fp, const RapidjsonValue &json, bool indent,
                bool _sort_keys)
@@ -97,12 +135,66 @@ bool dump_json(const RapidjsonValue &json, bool indent, bool sort_keys)
     return dump_json(stdout, json, indent, sort_keys);
 }
 
+MappedFile::MappedFile(const std::string &path, bool writable)
+{
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    opened = true;
+    struct stat st;
+    // the rest of the last page reads as zeros, a '\0' after the data
+    // unless the size is a multiple of the page size
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (!writable || st.st_size % ::sysconf(_SC_PAGESIZE) != 0)) {
+        void *addr =
+            ::mmap(nullptr, st.st_size,
+                   writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE,
+                   fd, 0);
+        if (addr != MAP_FAILED) {
+            // hints only, decoders read front to back
+            ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+            ::madvise(addr, st.st_size, MADV_HUGEPAGE);
+#endif
+            mapped = true;
+            data_ = static_cast<char *>(addr);
+            size_ = st.st_size;
+        }
+    }
+    ::close(fd);
+    if (mapped) {
+        return;
+    }
+#endif
+    // empty, not a regular file, or no mmap: read in one go (std::string
+    // has the '\0')
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return;
+    }
+    opened = true;
+    buffer.assign(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>());
+    data_ = &buffer[0];
+    size_ = buffer.size();
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if (mapped) {
+        ::munmap(data_, size_);
+    }
+#endif
+}
+
 std::string load_bytes(const std::string &path)
 {
-    std::ifstream t(path.c_str());
-    std::stringstream buffer;
-    buffer << t.rdbuf();
-    return buffer.str();
+    // copied once, straight from the mapped pages
+    MappedFile file(path);
+    return std::string(file.data(), file.size());
 }
 std::string load_bytes()
 {
@@ -119,6 +211,412 @@ bool dump_bytes(const std::string &path, const std::string &bytes)
     return true;
 }
 
+// SAX handler that never holds the DOM of the whole document: members of the
+// top-level object are built one by one, elements of its "features" array are
+// handed over to `on_feature` one at a time and then dropped.
+struct FeatureStreamHandler
+{
+    using Callback = std::function<bool(RapidjsonValue &)>;
+    FeatureStreamHandler(const Callback &on_feature) : on_feature(on_feature)
+    {
+    }
+
+    bool Null() { return value(RapidjsonValue{}); }
+    bool Bool(bool b) { return value(RapidjsonValue(b)); }
+    bool Int(int i) { return value(RapidjsonValue(i)); }
+    bool Uint(unsigned u) { return value(RapidjsonValue(u)); }
+    bool Int64(int64_t i) { return value(RapidjsonValue(i)); }
+    bool Uint64(uint64_t u) { return value(RapidjsonValue(u)); }
+    bool Double(double d) { return value(RapidjsonValue(d)); }
+    bool RawNumber(const char *str, rapidjson::SizeType len, bool copy)
+    {
+        return false; // only with kParseNumbersAsStringsFlag
+    }
+    bool String(const char *str, rapidjson::SizeType len, bool copy)
+    {
+        return value(RapidjsonValue(str, len, allocator));
+    }
+    bool Key(const char *str, rapidjson::SizeType len, bool copy)
+    {
+        if (depth == 1) {
+            key.assign(str, len);
+            return true;
+        }
+        stack.emplace_back(str, len, allocator);
+        return true;
+    }
+    bool StartObject()
+    {
+        if (depth == 0) {
+            top.SetObject();
+        }
+        ++depth;
+        return true;
+    }
+    bool EndObject(rapidjson::SizeType count)
+    {
+        if (--depth == 0) {
+            return true;
+        }
+        RapidjsonValue obj(rapidjson::kObjectType);
+        auto begin = stack.end() - 2 * count;
+        for (auto it = begin; it != stack.end(); it += 2) {
+            obj.AddMember(*it, *(it + 1), allocator);
+        }
+        stack.erase(begin, stack.end());
+        return value(std::move(obj));
+    }
+    bool StartArray()
+    {
+        if (depth == 0) {
+            return false; // GeoJSON should be an object
+        }
+        if (depth == 1 && key == "features") {
+            streaming = true;
+        }
+        ++depth;
+        return true;
+    }
+    bool EndArray(rapidjson::SizeType count)
+    {
+        if (--depth == 1 && streaming) {
+            streaming = false;
+            return true;
+        }
+        RapidjsonValue arr(rapidjson::kArrayType);
+        arr.Reserve(count, allocator);
+        auto begin = stack.end() - count;
+        for (auto it = begin; it != stack.end(); ++it) {
+            arr.PushBack(*it, allocator);
+        }
+        stack.erase(begin, stack.end());
+        return value(std::move(arr));
+    }
+
+    // members of the top-level object, except for "features"
+    RapidjsonValue top;
+
+  private:
+    bool value(RapidjsonValue &&v)
+    {
+        if (depth == 1) {
+            top.AddMember(RapidjsonValue(key.data(), key.size(), allocator), v,
+                          allocator);
+            return true;
+        }
+        if (depth == 2 && streaming) {
+            return on_feature(v);
+        }
+        stack.push_back(std::move(v));
+        return true;
+    }
+
+    const Callback &on_feature;
+    RapidjsonAllocator allocator;
+    std::vector<RapidjsonValue> stack;
+    std::string key;
+    int depth = 0;
+    bool streaming = false;
+};
+
+// Cheap SAX scan over a GeoJSON FeatureCollection, nothing is materialized,
+// only keys (in document order), dimension and precision are collected.
+struct GeoJSONScanner
+{
+    GeoJSONScanner(uint32_t maxPrecision) : maxPrecision(maxPrecision) {}
+
+    bool Null() { return true; }
+    bool Bool(bool b) { return true; }
+    bool Int(int i) { return number(i); }
+    bool Uint(unsigned u) { return number(u); }
+    bool Int64(int64_t i) { return number(i); }
+    bool Uint64(uint64_t u) { return number(u); }
+    bool Double(double d) { return number(d); }
+    bool RawNumber(const char *str, rapidjson::SizeType len, bool copy)
+    {
+        return false; // only with kParseNumbersAsStringsFlag
+    }
+    bool String(const char *str, rapidjson::SizeType len, bool copy)
+    {
+        if (contexts.size() == 1 && key == "type") {
+            type.assign(str, len);
+        }
+        return true;
+    }
+    bool Key(const char *str, rapidjson::SizeType len, bool copy)
+    {
+        key.assign(str, len);
+        switch (contexts.back().state) {
+        case TOP:
+            if (key != "type" && key != "features") {
+                top_keys.push_back(key);
+            }
+            break;
+        case FEATURE:
+            if (key != "type" && key != "geometry" && key != "properties" &&
+                key != "id") {
+                saveKey(key);
+            }
+            break;
+        case PROPS:
+            saveKey(key);
+            break;
+        case GEOMETRY:
+            if (key != "type" && key != "coordinates" &&
+                key != "geometries") {
+                saveKey(key);
+            }
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+    bool StartObject()
+    {
+        contexts.push_back({child(true), 0});
+        return true;
+    }
+    bool EndObject(rapidjson::SizeType count)
+    {
+        contexts.pop_back();
+        return true;
+    }
+    bool StartArray()
+    {
+        contexts.push_back({child(false), 0});
+        return true;
+    }
+    bool EndArray(rapidjson::SizeType count)
+    {
+        contexts.pop_back();
+        return true;
+    }
+
+    bool is_feature_collection() const { return type == "FeatureCollection"; }
+    // keys in order of first appearance in the document, then the keys of
+    // the feature collection's custom properties. Encoder::analyze walks
+    // (unordered) property maps instead, so the key tables, and the bytes,
+    // may differ from encode(json)
+    std::vector<std::string> ordered_keys() const
+    {
+        auto ret = keys;
+        for (auto &k : top_keys) {
+            if (!seen.count(k)) {
+                ret.push_back(k);
+            }
+        }
+        return ret;
+    }
+
+    const uint32_t maxPrecision;
+    uint32_t dim = MAPBOX_GEOBUF_DEFAULT_DIM;
+    uint32_t e = 1;
+
+  private:
+    enum State
+    {
+        TOP,
+        FEATURES,
+        FEATURE,
+        PROPS,
+        GEOMETRY,
+        GEOMETRIES,
+        COORDS,
+        OTHER,
+    };
+    struct Context
+    {
+        State state;
+        int count; // #numbers seen, for positions in coordinates
+    };
+
+    State child(bool is_object) const
+    {
+        if (contexts.empty()) {
+            return is_object ? TOP : OTHER;
+        }
+        switch (contexts.back().state) {
+        case TOP:
+            return !is_object && key == "features" ? FEATURES : OTHER;
+        case FEATURES:
+            return is_object ? FEATURE : OTHER;
+        case FEATURE:
+            if (is_object && key == "properties") {
+                return PROPS;
+            }
+            return is_object && key == "geometry" ? GEOMETRY : OTHER;
+        case GEOMETRY:
+            if (!is_object && key == "coordinates") {
+                return COORDS;
+            }
+            return !is_object && key == "geometries" ? GEOMETRIES : OTHER;
+        case GEOMETRIES:
+            return is_object ? GEOMETRY : OTHER;
+        case COORDS:
+            return !is_object ? COORDS : OTHER;
+        default:
+            return OTHER;
+        }
+    }
+
+    // same as Encoder::analyzePoint, one coordinate at a time
+    bool number(double x)
+    {
+        if (contexts.empty() || contexts.back().state != COORDS) {
+            return true;
+        }
+        int i = contexts.back().count++;
+        if (i >= 3) {
+            return true;
+        }
+        if (i == 2 && x != 0) {
+            dim = std::max(dimXYZ, dim);
+        }
+        while (std::round(x * e) / e != x && e < maxPrecision) {
+            e *= 10;
+        }
+        return true;
+    }
+
+    void saveKey(const std::string &key)
+    {
+        if (seen.insert(key).second) {
+            keys.push_back(key);
+        }
+    }
+
+    std::vector<Context> contexts;
+    std::string key;
+    std::string type;
+    std::vector<std::string> keys, top_keys;
+    std::unordered_set<std::string> seen;
+};
+
+template <typename Handler>
+static bool parse_file(const std::string &path, Handler &handler)
+{
+    std::unique_ptr<FILE, decltype(&fclose)> fp(fopen(path.c_str(), "rb"),
+                                                &fclose);
+    if (!fp) {
+        return false;
+    }
+    char readBuffer[65536];
+    rapidjson::FileReadStream is(fp.get(), readBuffer, sizeof(readBuffer));
+    rapidjson::Reader reader;
+    reader.Parse<RJFLAGS>(is, handler);
+    return !reader.HasParseError();
+}
+
+static bool for_each_feature(const std::string &path,
+                             const FeatureStreamHandler::Callback &on_feature,
+                             RapidjsonValue *top = nullptr)
+{
+    FeatureStreamHandler handler(on_feature);
+    if (!parse_file(path, handler)) {
+        return false;
+    }
+    if (top) {
+        *top = std::move(handler.top);
+    }
+    return true;
+}
+
+// split [0, n) into `threads` contiguous chunks, run fn(index, begin, end) for
+// each of them on its own thread, rethrow the first exception (if any)
+template <typename Fn>
+static void parallel_for(size_t n, int threads, const Fn &fn)
+{
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    std::exception_ptr error;
+    std::mutex mutex;
+    for (int i = 0; i < threads; ++i) {
+        size_t begin = n * i / threads;
+        size_t end = n * (i + 1) / threads;
+        workers.emplace_back([&, i, begin, end]() {
+            try {
+                fn(i, begin, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+static size_t varint_size(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80u) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+// size of a length delimited field, 0 for an empty submessage/packed field
+// since protozero writes nothing for them
+static size_t message_size(int tag, size_t size)
+{
+    if (!size) {
+        return 0;
+    }
+    return varint_size((tag << 3) | 2) + varint_size(size) + size;
+}
+
+template <typename Iterator>
+static size_t packed_varint_size(Iterator first, Iterator last)
+{
+    size_t size = 0;
+    for (; first != last; ++first) {
+        size += varint_size(*first);
+    }
+    return size;
+}
+
+// like pbf.add_packed_uint64, but the length is computed up front instead of
+// being reserved then patched (memmove)
+template <typename Iterator>
+static void add_packed_varint(protozero::pbf_writer &pbf, int tag,
+                              Iterator first, Iterator last)
+{
+    const size_t size = packed_varint_size(first, last);
+    if (!size) {
+        return;
+    }
+    protozero::packed_field_uint64 field{pbf, static_cast<uint32_t>(tag),
+                                         size};
+    for (; first != last; ++first) {
+        field.add_element(*first);
+    }
+}
+
+// quantized, delta-encoded and zigzag-ed coordinates of a line, block by block
+// on the stack, fn(values, count) for each block
+template <typename Fn>
+static void quantize_line(const PointsType &line, bool closed, int dim,
+                          double e, const Fn &fn)
+{
+    constexpr size_t BLOCK = 256;
+    uint64_t block[BLOCK * 3];
+    int64_t prev[3] = {0, 0, 0};
+    int len = line.size() - (closed ? 1 : 0);
+    for (int i = 0; i < len; i += BLOCK) {
+        size_t n = std::min(BLOCK, static_cast<size_t>(len - i));
+        kernels::quantize_delta_zigzag(&line[i].x, n, dim, e, prev, block);
+        fn(block, n * dim);
+    }
+}
+
 template <typename T> RapidjsonValue to_json(const T &t)
 {
     RapidjsonAllocator allocator;
@@ -214,6 +712,26 @@ std::string Encoder::encode(const mapbox::geojson::geojson &geojson)
     keys.clear();
     analyze(geojson);
 
+    std::string data;
+    Encoder::Pbf pbf{data};
+    writeHeader(pbf);
+    geojson.match(
+        [&](const mapbox::geojson::feature_collection &features) {
+            protozero::pbf_writer pbf_fc{pbf, 4};
+            writeFeatureCollection(features, pbf_fc);
+        },
+        [&](const mapbox::geojson::feature &feature) {
+            writeFeature(feature, pbf, 5);
+        },
+        [&](const mapbox::geojson::geometry &geometry) {
+            writeGeometry(geometry, pbf, 6);
+        });
+    keys.clear();
+    return data;
+}
+
+void Encoder::writeHeader(Pbf &pbf)
+{
     std::vector<std::pair<const std::string *, uint32_t>> keys_vec;
     keys_vec.reserve(keys.size());
     for (auto &pair : keys) {
@@ -223,9 +741,6 @@ std::string Encoder::encode(const mapbox::geojson::geojson &geojson)
               [](const auto &kv1, const auto &kv2) {
                   return kv1.second < kv2.second;
               });
-
-    std::string data;
-    Encoder::Pbf pbf{data};
     for (auto &kv : keys_vec) {
         pbf.add_string(1, *kv.first);
     }
@@ -237,22 +752,6 @@ std::string Encoder::encode(const mapbox::geojson::geojson &geojson)
         MAPBOX_GEOBUF_DEFAULT_PRECISION) { // assumed default precision in proto
         pbf.add_uint32(3, precision);
     }
-
-    geojson.match(
-        [&](const mapbox::geojson::feature_collection &features) {
-            protozero::pbf_writer pbf_fc{pbf, 4};
-            writeFeatureCollection(features, pbf_fc);
-        },
-        [&](const mapbox::geojson::feature &feature) {
-            protozero::pbf_writer pbf_f{pbf, 5};
-            writeFeature(feature, pbf_f);
-        },
-        [&](const mapbox::geojson::geometry &geometry) {
-            protozero::pbf_writer pbf_g{pbf, 6};
-            writeGeometry(geometry, pbf_g);
-        });
-    keys.clear();
-    return data;
 }
 
 std::string Encoder::encode(const std::string &geojson_text)
@@ -274,32 +773,170 @@ std::string Encoder::encode(const RapidjsonValue &json)
     return encode(geojson);
 }
 
+std::vector<std::string>
+Encoder::encode_many(const std::vector<mapbox::geojson::geojson> &geojsons)
+{
+    std::vector<std::string> encoded(geojsons.size());
+    const int num_threads = std::min<int>(threads, geojsons.size());
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < geojsons.size(); ++i) {
+            encoded[i] = encode(geojsons[i]);
+        }
+        return encoded;
+    }
+    parallel_for(geojsons.size(), num_threads,
+                 [&](int, size_t begin, size_t end) {
+                     Encoder worker(maxPrecision);
+                     for (size_t i = begin; i < end; ++i) {
+                         encoded[i] = worker.encode(geojsons[i]);
+                     }
+                 });
+    return encoded;
+}
+
 bool Encoder::encode(const std::string &input_path,
                      const std::string &output_path)
 {
-    auto json = mapbox::geobuf::load_json(input_path);
-    auto bytes = encode(mapbox::geojson::convert(json));
-    return dump_bytes(output_path, bytes);
+    // 1st pass: cheap SAX scan for keys/dim/e, nothing is materialized
+    GeoJSONScanner scanner(maxPrecision);
+    if (!parse_file(input_path, scanner)) {
+        return false;
+    }
+    if (!scanner.is_feature_collection()) {
+        // single feature or geometry, nothing to stream
+        return dump_bytes(output_path, encode(load_json(input_path)));
+    }
+    dim = scanner.dim;
+    e = scanner.e;
+    keys.clear();
+    for (auto &key : scanner.ordered_keys()) {
+        saveKey(key);
+    }
+
+    // 2nd pass: features are streamed (SAX) one at a time, encoded feature
+    // messages are spooled to a temporary file because the length of the
+    // feature collection message is only known at the end
+    std::unique_ptr<FILE, decltype(&fclose)> spool(std::tmpfile(), &fclose);
+    if (!spool) {
+        return false;
+    }
+    size_t body_size = 0;
+    std::string buffer;
+    auto flush = [&]() {
+        body_size += buffer.size();
+        return fwrite(buffer.data(), 1, buffer.size(), spool.get()) ==
+               buffer.size();
+    };
+    RapidjsonValue top;
+    bool succ = for_each_feature(
+        input_path,
+        [&](RapidjsonValue &json) {
+            buffer.clear();
+            Encoder::Pbf pbf{buffer};
+            writeFeature(
+                mapbox::geojson::convert<mapbox::geojson::feature>(json), pbf,
+                1);
+            return flush();
+        },
+        &top);
+    if (succ) {
+        RapidjsonAllocator allocator;
+        RapidjsonValue features(rapidjson::kArrayType);
+        top.AddMember("features", features, allocator);
+        auto fc = mapbox::geojson::convert(top)
+                      .get<mapbox::geojson::feature_collection>();
+        if (!fc.custom_properties.empty()) {
+            buffer.clear();
+            Encoder::Pbf pbf{buffer};
+            clearSizes();
+            sizeProps(fc.custom_properties, 15);
+            writeProps(fc.custom_properties, pbf, 15);
+            succ = flush();
+        }
+    }
+    buffer.clear();
+    {
+        Encoder::Pbf pbf{buffer};
+        writeHeader(pbf);
+    }
+    keys.clear();
+    if (!succ) {
+        return false;
+    }
+    if (body_size) {
+        // tag 4, length delimited
+        protozero::write_varint(std::back_inserter(buffer), (4u << 3) | 2u);
+        protozero::write_varint(std::back_inserter(buffer), body_size);
+    }
+    std::unique_ptr<FILE, decltype(&fclose)> fp(
+        fopen(output_path.c_str(), "wb"), &fclose);
+    if (!fp ||
+        fwrite(buffer.data(), 1, buffer.size(), fp.get()) != buffer.size()) {
+        return false;
+    }
+    rewind(spool.get());
+    char chunk[65536];
+    size_t n = 0;
+    while ((n = fread(chunk, 1, sizeof(chunk), spool.get())) > 0) {
+        if (fwrite(chunk, 1, n, fp.get()) != n) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void Encoder::analyze(const mapbox::geojson::geojson &geojson)
 {
-    auto analyze_feature = [&](const mapbox::geojson::feature &f) {
-        saveKey(f.properties);
-        saveKey(f.custom_properties);
-        analyzeGeometry(f.geometry);
-    };
     geojson.match(
-        [&](const mapbox::geojson::feature &f) { analyze_feature(f); },
+        [&](const mapbox::geojson::feature &f) { analyzeFeature(f); },
         [&](const mapbox::geojson::geometry &g) { analyzeGeometry(g); },
         [&](const mapbox::geojson::feature_collection &fc) {
-            for (auto &f : fc) {
-                analyze_feature(f);
-            }
+            analyzeFeatures(fc);
             saveKey(fc.custom_properties);
         });
 }
 
+void Encoder::analyzeFeatures(const std::vector<mapbox::geojson::feature> &fc)
+{
+    const int num_threads =
+        std::min<int>(threads, fc.size() / MIN_FEATURES_PER_THREAD);
+    if (num_threads <= 1) {
+        for (auto &f : fc) {
+            analyzeFeature(f);
+        }
+        return;
+    }
+    // Each chunk is analyzed from scratch, then merged in chunk order:
+    // max of dim and e, keys in order of first appearance. Same as the serial
+    // path, since a coordinate exact at 10^k stays exact at 10^(k+1).
+    std::vector<Encoder> workers(num_threads, Encoder(maxPrecision));
+    parallel_for(fc.size(), num_threads,
+                 [&](int index, size_t begin, size_t end) {
+                     auto &worker = workers[index];
+                     for (size_t i = begin; i < end; ++i) {
+                         worker.analyzeFeature(fc[i]);
+                     }
+                 });
+    for (auto &worker : workers) {
+        dim = std::max(dim, worker.dim);
+        e = std::max(e, worker.e);
+        std::vector<const std::string *> ordered(worker.keys.size());
+        for (auto &pair : worker.keys) {
+            ordered[pair.second] = &pair.first;
+        }
+        for (auto *key : ordered) {
+            saveKey(*key);
+        }
+    }
+}
+
+void Encoder::analyzeFeature(const mapbox::geojson::feature &feature)
+{
+    saveKey(feature.properties);
+    saveKey(feature.custom_properties);
+    analyzeGeometry(feature.geometry);
+}
+
 void Encoder::analyzeGeometry(const mapbox::geojson::geometry &geometry)
 {
     geometry.match(
@@ -374,26 +1011,87 @@ void Encoder::saveKey(const mapbox::feature::property_map &props)
 void Encoder::writeFeatureCollection(
     const mapbox::geojson::feature_collection &geojson, Pbf &pbf)
 {
-    for (auto &feature : geojson) {
-        protozero::pbf_writer pbf_f{pbf, 1};
-        writeFeature(feature, pbf_f);
+    // not worth spawning threads for a few features
+    const int num_threads =
+        std::min<int>(threads, geojson.size() / MIN_FEATURES_PER_THREAD);
+    if (num_threads <= 1) {
+        for (auto &feature : geojson) {
+            writeFeature(feature, pbf, 1);
+        }
+    } else {
+        // key table is fixed, feature messages are independent: encode
+        // chunks into per-thread buffers, then append them in order
+        std::vector<std::string> buffers(num_threads);
+        std::vector<std::vector<size_t>> offsets(num_threads);
+        parallel_for(geojson.size(), num_threads,
+                     [&](int index, size_t begin, size_t end) {
+                         auto worker = *this;
+                         auto &buffer = buffers[index];
+                         auto &offset = offsets[index];
+                         offset.reserve(end - begin + 1);
+                         offset.push_back(0);
+                         for (size_t i = begin; i < end; ++i) {
+                             Encoder::Pbf pbf_f{buffer};
+                             worker.sizeFeature(geojson[i]);
+                             worker.writeFeature(geojson[i], pbf_f);
+                             offset.push_back(buffer.size());
+                         }
+                     });
+        for (int i = 0; i < num_threads; ++i) {
+            const auto *data = buffers[i].data();
+            const auto &offset = offsets[i];
+            for (size_t j = 1; j < offset.size(); ++j) {
+                // empty submessages are rolled back in serial mode
+                if (offset[j] != offset[j - 1]) {
+                    pbf.add_message(1, data + offset[j - 1],
+                                    offset[j] - offset[j - 1]);
+                }
+            }
+            std::string().swap(buffers[i]);
+        }
     }
     if (!geojson.custom_properties.empty()) {
+        clearSizes();
+        sizeProps(geojson.custom_properties, 15);
         writeProps(geojson.custom_properties, pbf, 15);
     }
 }
 
+void Encoder::writeFeature(const mapbox::geojson::feature &feature, Pbf &pbf,
+                           int tag)
+{
+    const size_t size = sizeFeature(feature);
+    if (size) {
+        Encoder::Pbf pbf_f{pbf, static_cast<uint32_t>(tag), size};
+        writeFeature(feature, pbf_f);
+    }
+}
+
+void Encoder::writeGeometry(const mapbox::geojson::geometry &geometry,
+                            Pbf &pbf, int tag)
+{
+    clearSizes();
+    const size_t size = sizeGeometry(geometry);
+    if (size) {
+        Encoder::Pbf pbf_g{pbf, static_cast<uint32_t>(tag), size};
+        writeGeometry(geometry, pbf_g);
+    }
+}
+
 void Encoder::writeFeature(const mapbox::geojson::feature &feature, Pbf &pbf)
 {
     if (!feature.geometry.is<mapbox::geojson::empty>()) {
-        protozero::pbf_writer pbf_geom{pbf, 1};
-        writeGeometry(feature.geometry, pbf_geom);
+        const size_t size = sizes[next_size++];
+        if (size) {
+            Encoder::Pbf pbf_geom{pbf, 1, size};
+            writeGeometry(feature.geometry, pbf_geom);
+        }
     }
     if (!feature.id.is<mapbox::geojson::null_value_t>()) {
         feature.id.match([&](int64_t id) { pbf.add_int64(12, id); },
                          [&](const std::string &id) { pbf.add_string(11, id); },
                          [&](const auto &) {
-                             pbf.add_string(11, dump(to_json(feature.id)));
+                             pbf.add_string(11, dumped[next_dumped++]);
                          });
     }
     if (!feature.properties.empty()) {
@@ -435,8 +1133,11 @@ void Encoder::writeGeometry(const mapbox::geojson::geometry &geometry,
         [&](const mapbox::geojson::geometry_collection &geometries) {
             pbf.add_enum(1, 6);
             for (auto &geom : geometries) {
-                protozero::pbf_writer pbf_sub{pbf, 4};
-                writeGeometry(geom, pbf_sub);
+                const size_t size = sizes[next_size++];
+                if (size) {
+                    Encoder::Pbf pbf_sub{pbf, 4, size};
+                    writeGeometry(geom, pbf_sub);
+                }
             }
         },
         [&](const mapbox::geojson::empty &empty) {});
@@ -448,15 +1149,15 @@ void Encoder::writeGeometry(const mapbox::geojson::geometry &geometry,
 void Encoder::writeProps(const mapbox::feature::property_map &props,
                          Encoder::Pbf &pbf, int tag)
 {
-    std::vector<uint32_t> indexes;
+    indexes.clear();
     int valueIndex = 0;
     for (auto &pair : props) {
-        protozero::pbf_writer pbf_value{pbf, 13};
+        Encoder::Pbf pbf_value{pbf, 13, sizes[next_size++]};
         writeValue(pair.second, pbf_value);
         indexes.push_back(keys.at(pair.first));
         indexes.push_back(valueIndex++);
     }
-    pbf.add_packed_uint32(tag, indexes.begin(), indexes.end());
+    add_packed_varint(pbf, tag, indexes.begin(), indexes.end());
 }
 
 void Encoder::writeValue(const mapbox::feature::value &value, Encoder::Pbf &pbf)
@@ -466,49 +1167,55 @@ void Encoder::writeValue(const mapbox::feature::value &value, Encoder::Pbf &pbf)
                 [&](int64_t val) { pbf.add_uint64(4, -val); },
                 [&](double val) { pbf.add_double(2, val); },
                 [&](const std::string &val) { pbf.add_string(1, val); },
-                [&](const auto &) { pbf.add_string(6, dump(to_json(value))); });
+                [&](const auto &) {
+                    pbf.add_string(6, dumped[next_dumped++]);
+                });
     //
 }
 
-void Encoder::writePoint(const mapbox::geojson::point &point, Encoder::Pbf &pbf)
+void Encoder::writePoint(const mapbox::geojson::point &, Encoder::Pbf &pbf)
 {
-    std::vector<int64_t> coords;
-    coords.reserve(dim);
-    const double *ptr = &point.x;
-    for (int i = 0; i < dim; ++i) {
-        coords.push_back(static_cast<int64_t>(std::round(ptr[i] * e)));
-    }
-    pbf.add_packed_sint64(3, coords.begin(), coords.end());
+    const auto coords = quantized.begin() + next_quantized;
+    next_quantized += dim;
+    add_packed_varint(pbf, 3, coords, coords + dim);
 }
 
+// coordinates are zigzag-ed already, packed uint64 of them is byte-identical
+// to packed sint64 of the deltas
 void Encoder::writeLine(const PointsType &line, Encoder::Pbf &pbf)
 {
-    auto coords = populateLine(line, false);
-    pbf.add_packed_sint64(3, coords.begin(), coords.end());
+    const size_t size = sizes[next_size++];
+    if (!size) {
+        return;
+    }
+    protozero::packed_field_uint64 coords{pbf, 3, size};
+    populateLine(coords, line, false);
 }
 void Encoder::writeMultiLine(const LinesType &lines, Encoder::Pbf &pbf,
                              bool closed)
 {
     int len = lines.size();
     if (len != 1) {
-        std::vector<std::uint32_t> lengths;
-        lengths.reserve(len);
+        lengths.clear();
         for (auto &line : lines) {
             lengths.push_back(line.size() - (closed ? 1 : 0));
         }
-        pbf.add_packed_uint32(2, lengths.begin(), lengths.end());
+        add_packed_varint(pbf, 2, lengths.begin(), lengths.end());
     }
-    std::vector<int64_t> coords;
+    const size_t size = sizes[next_size++];
+    if (!size) {
+        return;
+    }
+    protozero::packed_field_uint64 coords{pbf, 3, size};
     for (auto &line : lines) {
         populateLine(coords, line, closed);
     }
-    pbf.add_packed_sint64(3, coords.begin(), coords.end());
 }
 void Encoder::writeMultiPolygon(const PolygonsType &polygons, Encoder::Pbf &pbf)
 {
     int len = polygons.size();
     if (len != 1 || polygons[0].size() != 1) {
-        std::vector<std::uint32_t> lengths;
+        lengths.clear();
         lengths.push_back(len); // n_polygons
         for (auto &polygon : polygons) {
             lengths.push_back(polygon.size()); // n_rings
@@ -516,53 +1223,366 @@ void Encoder::writeMultiPolygon(const PolygonsType &polygons, Encoder::Pbf &pbf)
                 lengths.push_back(ring.size() - 1); // n_points
             }
         }
-        pbf.add_packed_uint32(2, lengths.begin(), lengths.end());
+        add_packed_varint(pbf, 2, lengths.begin(), lengths.end());
+    }
+    const size_t size = sizes[next_size++];
+    if (!size) {
+        return;
     }
-    std::vector<int64_t> coords;
+    protozero::packed_field_uint64 coords{pbf, 3, size};
     for (auto &polygon : polygons) {
         for (auto &ring : polygon) {
             populateLine(coords, ring, true);
         }
     }
-    pbf.add_packed_sint64(3, coords.begin(), coords.end());
 }
 
-std::vector<int64_t> Encoder::populateLine(const PointsType &line, bool closed)
+void Encoder::populateLine(protozero::packed_field_uint64 &coords, //
+                           const PointsType &line,                 //
+                           bool closed)
 {
-    std::vector<int64_t> coords;
-    populateLine(coords, line, closed);
-    return coords;
+    // quantized by the sizing pass, varints go straight into the output
+    const size_t skipped = closed ? 1 : 0;
+    const size_t n = line.size() > skipped ? (line.size() - skipped) * dim : 0;
+    for (size_t k = 0; k < n; ++k) {
+        coords.add_element(quantized[next_quantized++]);
+    }
 }
 
-void Encoder::populateLine(std::vector<int64_t> &coords, //
-                           const PointsType &line,       //
-                           bool closed)
+void Encoder::clearSizes()
 {
-    coords.reserve(coords.size() + dim * line.size());
-    int len = line.size() - (closed ? 1 : 0);
-    auto sum = std::array<int64_t, 3>{0, 0, 0};
-    for (int i = 0; i < len; ++i) {
-        const double *ptr = &line[i].x;
-        for (int j = 0; j < dim; ++j) {
-            auto n = static_cast<int64_t>(std::round(ptr[j] * e)) - sum[j];
-            coords.push_back(n);
-            sum[j] += n;
-        }
-    }
+    sizes.clear();
+    next_size = 0;
+    dumped.clear();
+    next_dumped = 0;
+    quantized.clear();
+    next_quantized = 0;
 }
 
-std::string Decoder::to_printable(const std::string &pbf_bytes,
-                                  const std::string &indent)
+size_t Encoder::sizeFeature(const mapbox::geojson::feature &feature)
 {
-    // TODO, read the code
-    return ::decode(pbf_bytes.data(), pbf_bytes.size(), indent);
+    clearSizes();
+    size_t size = 0;
+    if (!feature.geometry.is<mapbox::geojson::empty>()) {
+        const size_t slot = sizes.size();
+        sizes.push_back(0);
+        const size_t geom_size = sizeGeometry(feature.geometry);
+        sizes[slot] = geom_size;
+        size += message_size(1, geom_size);
+    }
+    if (!feature.id.is<mapbox::geojson::null_value_t>()) {
+        feature.id.match(
+            [&](int64_t id) {
+                size += 1 + varint_size(static_cast<uint64_t>(id));
+            },
+            [&](const std::string &id) {
+                size += 1 + varint_size(id.size()) + id.size();
+            },
+            [&](const auto &) {
+                dumped.push_back(dump(to_json(feature.id)));
+                const auto &id = dumped.back();
+                size += 1 + varint_size(id.size()) + id.size();
+            });
+    }
+    if (!feature.properties.empty()) {
+        size += sizeProps(feature.properties, 14);
+    }
+    if (!feature.custom_properties.empty()) {
+        size += sizeProps(feature.custom_properties, 15);
+    }
+    return size;
 }
 
-mapbox::geojson::geojson Decoder::decode(const std::string &pbf_bytes)
+size_t Encoder::sizeGeometry(const mapbox::geojson::geometry &geometry)
 {
-    auto pbf = protozero::pbf_reader{pbf_bytes};
-    dim = MAPBOX_GEOBUF_DEFAULT_DIM;
-    e = std::pow(10, MAPBOX_GEOBUF_DEFAULT_PRECISION);
+    const size_t enum_size = 2; // tag 1 + type
+    size_t size = 0;
+    geometry.match(
+        [&](const mapbox::geojson::point &point) {
+            const double *ptr = &point.x;
+            size_t coords_size = 0;
+            for (int i = 0; i < dim; ++i) {
+                quantized.push_back(protozero::encode_zigzag64(
+                    static_cast<int64_t>(std::round(ptr[i] * e))));
+                coords_size += varint_size(quantized.back());
+            }
+            size = enum_size + message_size(3, coords_size);
+        },
+        [&](const mapbox::geojson::multi_point &points) {
+            size = enum_size + sizeLine(points);
+        },
+        [&](const mapbox::geojson::line_string &lines) {
+            size = enum_size + sizeLine(lines);
+        },
+        [&](const mapbox::geojson::multi_line_string &lines) {
+            size = enum_size + sizeMultiLine((LinesType &)lines, false);
+        },
+        [&](const mapbox::geojson::polygon &polygon) {
+            size = enum_size + sizeMultiLine((LinesType &)polygon, true);
+        },
+        [&](const mapbox::geojson::multi_polygon &polygons) {
+            size = enum_size + sizeMultiPolygon(polygons);
+        },
+        [&](const mapbox::geojson::geometry_collection &geometries) {
+            size = enum_size;
+            for (auto &geom : geometries) {
+                const size_t slot = sizes.size();
+                sizes.push_back(0);
+                const size_t geom_size = sizeGeometry(geom);
+                sizes[slot] = geom_size;
+                size += message_size(4, geom_size);
+            }
+        },
+        [&](const mapbox::geojson::empty &empty) {});
+    if (!geometry.custom_properties.empty()) {
+        size += sizeProps(geometry.custom_properties, 15);
+    }
+    return size;
+}
+
+size_t Encoder::sizeProps(const mapbox::feature::property_map &props, int tag)
+{
+    size_t size = 0;
+    size_t indexes_size = 0;
+    uint32_t valueIndex = 0;
+    for (auto &pair : props) {
+        // values always write a field, never rolled back
+        const size_t value_size = sizeValue(pair.second);
+        sizes.push_back(value_size);
+        size += 1 + varint_size(value_size) + value_size;
+        indexes_size += varint_size(keys.at(pair.first));
+        indexes_size += varint_size(valueIndex++);
+    }
+    return size + message_size(tag, indexes_size);
+}
+
+size_t Encoder::sizeValue(const mapbox::feature::value &value)
+{
+    auto string_size = [](size_t len) { return 1 + varint_size(len) + len; };
+    return value.match(
+        [&](bool) -> size_t { return 2; },
+        [&](uint64_t val) -> size_t { return 1 + varint_size(val); },
+        [&](int64_t val) -> size_t {
+            return 1 + varint_size(static_cast<uint64_t>(-val));
+        },
+        [&](double) -> size_t { return 9; },
+        [&](const std::string &val) -> size_t {
+            return string_size(val.size());
+        },
+        [&](const auto &) -> size_t {
+            dumped.push_back(dump(to_json(value)));
+            return string_size(dumped.back().size());
+        });
+}
+
+size_t Encoder::sizeLine(const PointsType &line, bool closed)
+{
+    size_t size = 0;
+    quantize_line(line, closed, dim, e, [&](const uint64_t *values, size_t n) {
+        size += packed_varint_size(values, values + n);
+        quantized.insert(quantized.end(), values, values + n);
+    });
+    sizes.push_back(size);
+    return message_size(3, size);
+}
+
+size_t Encoder::sizeMultiLine(const LinesType &lines, bool closed)
+{
+    size_t size = 0;
+    if (lines.size() != 1) {
+        size_t lengths_size = 0;
+        for (auto &line : lines) {
+            lengths_size += varint_size(
+                static_cast<uint32_t>(line.size() - (closed ? 1 : 0)));
+        }
+        size += message_size(2, lengths_size);
+    }
+    size_t coords_size = 0;
+    for (auto &line : lines) {
+        quantize_line(line, closed, dim, e,
+                      [&](const uint64_t *values, size_t n) {
+                          coords_size += packed_varint_size(values, values + n);
+                          quantized.insert(quantized.end(), values,
+                                           values + n);
+                      });
+    }
+    sizes.push_back(coords_size);
+    return size + message_size(3, coords_size);
+}
+
+size_t Encoder::sizeMultiPolygon(const PolygonsType &polygons)
+{
+    size_t size = 0;
+    if (polygons.size() != 1 || polygons[0].size() != 1) {
+        size_t lengths_size = varint_size(polygons.size());
+        for (auto &polygon : polygons) {
+            lengths_size += varint_size(polygon.size());
+            for (auto &ring : polygon) {
+                lengths_size +=
+                    varint_size(static_cast<uint32_t>(ring.size() - 1));
+            }
+        }
+        size += message_size(2, lengths_size);
+    }
+    size_t coords_size = 0;
+    for (auto &polygon : polygons) {
+        for (auto &ring : polygon) {
+            quantize_line(ring, true, dim, e,
+                          [&](const uint64_t *values, size_t n) {
+                              coords_size +=
+                                  packed_varint_size(values, values + n);
+                              quantized.insert(quantized.end(), values,
+                                               values + n);
+                          });
+        }
+    }
+    sizes.push_back(coords_size);
+    return size + message_size(3, coords_size);
+}
+
+std::string Decoder::to_printable(protozero::data_view pbf_bytes,
+                                  const std::string &indent)
+{
+    // TODO, read the code
+    return ::decode(pbf_bytes.data(), pbf_bytes.size(), indent);
+}
+
+mapbox::geojson::geojson Decoder::decode(protozero::data_view pbf_bytes)
+{
+    auto pbf = protozero::pbf_reader{pbf_bytes};
+    if (!readHeader(pbf)) {
+        return mapbox::geojson::geojson{};
+    }
+    const auto tag = pbf.tag();
+    if (tag == 4) {
+        protozero::pbf_reader pbf_fc = pbf.get_message();
+        return readFeatureCollection(pbf_fc);
+    } else if (tag == 5) {
+        protozero::pbf_reader pbf_f = pbf.get_message();
+        return readFeature(pbf_f);
+    } else {
+        protozero::pbf_reader pbf_g = pbf.get_message();
+        return readGeometry(pbf_g);
+    }
+}
+
+mapbox::geojson::geojson Decoder::decode_file(const std::string &path)
+{
+    MappedFile file(path);
+    if (!file) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    return decode(file.view());
+}
+
+std::vector<mapbox::geojson::geojson>
+Decoder::decode_many(const std::vector<protozero::data_view> &pbf_bytes)
+{
+    std::vector<mapbox::geojson::geojson> decoded(pbf_bytes.size());
+    const int num_threads = std::min<int>(threads, pbf_bytes.size());
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < pbf_bytes.size(); ++i) {
+            decoded[i] = decode(pbf_bytes[i]);
+        }
+        return decoded;
+    }
+    parallel_for(pbf_bytes.size(), num_threads,
+                 [&](int, size_t begin, size_t end) {
+                     // single-threaded, the threads are already taken
+                     Decoder worker;
+                     worker.wanted_properties = wanted_properties;
+                     worker.wanted_geometry = wanted_geometry;
+                     for (size_t i = begin; i < end; ++i) {
+                         decoded[i] = worker.decode(pbf_bytes[i]);
+                     }
+                 });
+    return decoded;
+}
+
+bool Decoder::decode(
+    protozero::data_view pbf_bytes,
+    const std::function<bool(mapbox::geojson::feature &)> &on_feature)
+{
+    auto pbf = protozero::pbf_reader{pbf_bytes};
+    if (!readHeader(pbf)) {
+        return true;
+    }
+    mapbox::geojson::feature feature;
+    if (pbf.tag() == 4) {
+        protozero::pbf_reader pbf_fc = pbf.get_message();
+        while (pbf_fc.next(1)) {
+            protozero::pbf_reader pbf_f = pbf_fc.get_message();
+            readFeature(pbf_f, feature);
+            if (!on_feature(feature)) {
+                return false;
+            }
+        }
+    } else if (pbf.tag() == 5) {
+        protozero::pbf_reader pbf_f = pbf.get_message();
+        readFeature(pbf_f, feature);
+        return on_feature(feature);
+    }
+    return true;
+}
+
+FeatureCursor::FeatureCursor(const Decoder &decoder,
+                             protozero::data_view pbf_bytes)
+    : decoder(decoder)
+{
+    auto pbf = protozero::pbf_reader{pbf_bytes};
+    if (!this->decoder.readHeader(pbf)) {
+        return;
+    }
+    if (pbf.tag() == 4) {
+        features = pbf.get_message();
+    } else if (pbf.tag() == 5) {
+        single = pbf.get_view();
+    }
+}
+
+mapbox::geojson::feature *FeatureCursor::next()
+{
+    if (single.data()) {
+        protozero::pbf_reader pbf_f{single};
+        single = {};
+        decoder.readFeature(pbf_f, feature);
+        return &feature;
+    }
+    if (!features.next(1)) {
+        return nullptr;
+    }
+    protozero::pbf_reader pbf_f = features.get_message();
+    decoder.readFeature(pbf_f, feature);
+    return &feature;
+}
+
+mapbox::geojson::feature_collection
+Decoder::decode(protozero::data_view pbf_bytes,
+                const std::array<double, 4> &bbox)
+{
+    auto pbf = protozero::pbf_reader{pbf_bytes};
+    if (!readHeader(pbf)) {
+        return {};
+    }
+    if (pbf.tag() == 4) {
+        protozero::pbf_reader pbf_fc = pbf.get_message();
+        return readFeatureCollection(pbf_fc, &bbox);
+    }
+    mapbox::geojson::feature_collection fc;
+    if (pbf.tag() == 5) {
+        auto view = pbf.get_view();
+        if (intersects(view, bbox)) {
+            protozero::pbf_reader pbf_f{view};
+            fc.push_back(readFeature(pbf_f));
+        }
+    }
+    return fc;
+}
+
+bool Decoder::readHeader(Pbf &pbf)
+{
+    dim = MAPBOX_GEOBUF_DEFAULT_DIM;
+    e = std::pow(10, MAPBOX_GEOBUF_DEFAULT_PRECISION);
     keys.clear();
     while (pbf.next()) {
         const auto tag = pbf.tag();
@@ -572,30 +1592,40 @@ mapbox::geojson::geojson Decoder::decode(const std::string &pbf_bytes)
             dim = pbf.get_uint32();
         } else if (tag == 3) {
             e = std::pow(10, pbf.get_uint32());
-        } else if (tag == 4) {
-            protozero::pbf_reader pbf_fc = pbf.get_message();
-            return readFeatureCollection(pbf_fc);
-        } else if (tag == 5) {
-            protozero::pbf_reader pbf_f = pbf.get_message();
-            return readFeature(pbf_f);
-        } else if (tag == 6) {
-            protozero::pbf_reader pbf_g = pbf.get_message();
-            return readGeometry(pbf_g);
+        } else if (tag == 4 || tag == 5 || tag == 6) {
+            if (wanted_properties) {
+                wanted_keys.assign(keys.size(), false);
+                for (size_t i = 0; i < keys.size(); ++i) {
+                    wanted_keys[i] = wanted_properties->count(keys[i]) > 0;
+                }
+            }
+            return true;
         } else {
             pbf.skip();
         }
     }
-    return mapbox::geojson::geojson{};
+    return false;
+}
+
+void Decoder::set_projection(
+    const std::optional<std::vector<std::string>> &properties, bool geometry)
+{
+    wanted_properties.reset();
+    if (properties) {
+        wanted_properties.emplace(properties->begin(), properties->end());
+    }
+    wanted_geometry = geometry;
 }
 
 bool Decoder::decode(const std::string &input_path,
                      const std::string &output_path, //
                      bool indent, bool sort_keys)
 {
-    auto bytes = load_bytes(input_path);
-    auto geojson = decode(bytes);
-    auto json = geojson2json(geojson, sort_keys);
-    return dump_json(output_path, json, indent);
+    MappedFile file(input_path);
+    if (!file) {
+        return false;
+    }
+    return decode_to_json(file.view(), output_path, indent, sort_keys);
 }
 
 void unpack_properties(mapbox::geojson::prop_map &properties,
@@ -610,15 +1640,17 @@ void unpack_properties(mapbox::geojson::prop_map &properties,
     }
 }
 
-mapbox::geojson::feature_collection Decoder::readFeatureCollection(Pbf &pbf)
+mapbox::geojson::feature_collection
+Decoder::readFeatureCollection(Pbf &pbf, const std::array<double, 4> *bbox)
 {
     mapbox::geojson::feature_collection fc;
+    // feature messages are only located here, decoded into their slots below
+    std::vector<protozero::data_view> features;
     std::vector<mapbox::geojson::value> values;
     while (pbf.next()) {
         const auto tag = pbf.tag();
         if (tag == 1) {
-            protozero::pbf_reader pbf_f = pbf.get_message();
-            fc.push_back(readFeature(pbf_f));
+            features.push_back(pbf.get_view());
         } else if (tag == 13) {
             protozero::pbf_reader pbf_v = pbf.get_message();
             values.push_back(readValue(pbf_v));
@@ -635,210 +1667,204 @@ mapbox::geojson::feature_collection Decoder::readFeatureCollection(Pbf &pbf)
             pbf.skip();
         }
     }
+    if (bbox) {
+        features.erase(std::remove_if(features.begin(), features.end(),
+                                      [&](protozero::data_view feature) {
+                                          return !intersects(feature, *bbox);
+                                      }),
+                       features.end());
+    }
+    fc.resize(features.size());
+    const int num_threads =
+        std::min<int>(threads, features.size() / MIN_FEATURES_PER_THREAD);
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < features.size(); ++i) {
+            protozero::pbf_reader pbf_f{features[i]};
+            readFeature(pbf_f, fc[i]);
+        }
+    } else {
+        // features only depend on the header (keys, dim, e), every thread
+        // decodes a range of them with its own copy of the decoder
+        parallel_for(features.size(), num_threads,
+                     [&](int, size_t begin, size_t end) {
+                         auto worker = *this;
+                         for (size_t i = begin; i < end; ++i) {
+                             protozero::pbf_reader pbf_f{features[i]};
+                             worker.readFeature(pbf_f, fc[i]);
+                         }
+                     });
+    }
     return fc;
 }
+
 mapbox::geojson::feature Decoder::readFeature(Pbf &pbf)
 {
     mapbox::geojson::feature f;
-    std::vector<mapbox::geojson::value> values;
+    readFeature(pbf, f);
+    return f;
+}
+
+void Decoder::readFeature(Pbf &pbf, mapbox::geojson::feature &f)
+{
+    // the geometry is refilled in place (below), or reset if there is none
+    bool has_geometry = false;
+    f.id = mapbox::geojson::null_value_t{};
+    f.properties.clear();
+    f.custom_properties.clear();
+    values.clear();
+    auto wanted_key = [&](uint32_t key) {
+        return key < wanted_keys.size() && wanted_keys[key];
+    };
+    if (wanted_properties) {
+        // values come before the indexes referencing them, so the indexes
+        // are scanned first (custom properties are always decoded)
+        wanted_values.clear();
+        auto scan = pbf;
+        while (scan.next()) {
+            const auto tag = scan.tag();
+            if (tag != 14 && tag != 15) {
+                scan.skip();
+                continue;
+            }
+            auto packed = scan.get_packed_uint32();
+            if (packed.size() % 2 != 0) {
+                continue;
+            }
+            for (auto it = packed.begin(); it != packed.end();) {
+                const auto key = *it++;
+                const auto value = *it++;
+                if (tag == 15 || wanted_key(key)) {
+                    if (value >= wanted_values.size()) {
+                        wanted_values.resize(value + 1);
+                    }
+                    wanted_values[value] = true;
+                }
+            }
+        }
+    }
     while (pbf.next()) {
         const auto tag = pbf.tag();
         if (tag == 1) {
+            if (!wanted_geometry) {
+                pbf.skip();
+                continue;
+            }
             protozero::pbf_reader pbf_g = pbf.get_message();
-            f.geometry = readGeometry(pbf_g);
+            readGeometry(pbf_g, f.geometry);
+            has_geometry = true;
         } else if (tag == 11) {
             f.id = pbf.get_string();
         } else if (tag == 12) {
             f.id = pbf.get_int64();
         } else if (tag == 13) {
+            const auto index = values.size();
+            if (wanted_properties && (index >= wanted_values.size() ||
+                                      !wanted_values[index])) {
+                // null placeholder, keeps the value indexes
+                pbf.skip();
+                values.emplace_back();
+                continue;
+            }
             protozero::pbf_reader pbf_v = pbf.get_message();
             values.push_back(readValue(pbf_v));
-        } else if (tag == 14) {
-            auto indexes = pbf.get_packed_uint32();
-            if (indexes.size() % 2 != 0) {
+        } else if (tag == 14 || tag == 15) {
+            auto packed = pbf.get_packed_uint32();
+            if (packed.size() % 2 != 0) {
                 continue;
             }
-            unpack_properties(
-                f.properties,                                          //
-                std::vector<uint32_t>(indexes.begin(), indexes.end()), //
-                keys, values);
-        } else if (tag == 15) {
-            auto indexes = pbf.get_packed_uint32();
-            if (indexes.size() % 2 != 0) {
-                continue;
+            indexes.assign(packed.begin(), packed.end());
+            if (wanted_properties && tag == 14) {
+                size_t kept = 0;
+                for (size_t i = 0; i < indexes.size(); i += 2) {
+                    if (wanted_key(indexes[i])) {
+                        indexes[kept++] = indexes[i];
+                        indexes[kept++] = indexes[i + 1];
+                    }
+                }
+                indexes.resize(kept);
             }
-            unpack_properties(
-                f.custom_properties,                                   //
-                std::vector<uint32_t>(indexes.begin(), indexes.end()), //
-                keys, values);
+            unpack_properties(tag == 14 ? f.properties : f.custom_properties,
+                              indexes, keys, values);
         } else {
             pbf.skip();
         }
     }
-    return f;
+    if (!has_geometry) {
+        f.geometry = mapbox::geojson::geometry{};
+    }
 }
 
-std::vector<mapbox::geojson::point>
-populate_points(const std::vector<int64_t> &int64s, //
-                int start_index, int length,        //
-                int dim, double e, bool closed = false)
+// number of varints in a packed field
+static size_t count_varints(protozero::data_view view)
 {
-    auto coords = std::vector<mapbox::geojson::point>{};
-    coords.resize(length + (closed ? 1 : 0));
-    auto prevP = std::array<int64_t, 3>{0, 0, 0};
-    for (int i = 0; i < length; ++i) {
-        double *p = &coords[i].x;
-        for (int d = 0; d < dim; ++d) {
-            prevP[d] += int64s[(start_index + i) * dim + d];
-            p[d] = prevP[d] / e;
-        }
+    return std::count_if(view.data(), view.data() + view.size(),
+                         [](char c) { return (c & 0x80) == 0; });
+}
+
+// decode `length` points (zigzag-ed deltas, packed) from [data, end) straight
+// into `points`, data is advanced
+static void populate_points(PointsType &points,                 //
+                            const char *&data, const char *end, //
+                            size_t length, int dim, double e,
+                            bool closed = false)
+{
+    points.resize(length + (closed ? 1 : 0));
+    if (length) {
+        auto prevP = std::array<int64_t, 3>{0, 0, 0};
+        data = kernels::decode_delta_zigzag(data, end, length, dim, e,
+                                            prevP.data(), &points[0].x);
     }
     if (closed) {
-        coords.back() = coords.front();
+        points.back() = points.front();
     }
-    return coords;
 }
 
 mapbox::geojson::geometry Decoder::readGeometry(Pbf &pbf)
 {
+    mapbox::geojson::geometry g;
+    readGeometry(pbf, g);
+    return g;
+}
+
+// g as a T, keeping its storage if it already is one
+template <typename T> static T &refill(mapbox::geojson::geometry &g)
+{
+    if (!g.is<T>()) {
+        g = T{};
+    }
+    return g.get<T>();
+}
+
+void Decoder::readGeometry(Pbf &pbf, mapbox::geojson::geometry &g)
+{
+    g.custom_properties.clear();
     if (!pbf.next()) {
-        return {};
+        g = mapbox::geojson::geometry{};
+        return;
     }
     const auto type = pbf.get_enum();
-    auto populatePoint = [&](mapbox::geojson::geometry &point,
-                             const std::vector<int64_t> &coords) {
-        if (dim == 3) {
-            point =
-                mapbox::geojson::point(coords[0] / static_cast<double>(e), //
-                                       coords[1] / static_cast<double>(e), //
-                                       coords[2] / static_cast<double>(e));
-        } else {
-            point =
-                mapbox::geojson::point(coords[0] / static_cast<double>(e), //
-                                       coords[1] / static_cast<double>(e));
-        }
-    };
-
-    auto populateMultiPoint = [&](mapbox::geojson::geometry &points,
-                                  const std::vector<int64_t> &coords) {
-        points = mapbox::geojson::multi_point{
-            populate_points(coords,                 //
-                            0, coords.size() / dim, //
-                            dim, e)};
-    };
-
-    auto populateLineString = [&](mapbox::geojson::geometry &line,
-                                  const std::vector<int64_t> &coords) {
-        line = mapbox::geojson::line_string{
-            populate_points(coords,                 //
-                            0, coords.size() / dim, //
-                            dim, e)};
-    };
-
-    auto populateMultiLineString = [&](mapbox::geojson::geometry &lines,
-                                       const std::vector<uint32_t> &lengths,
-                                       const std::vector<int64_t> &coords) {
-        if (lengths.empty()) {
-            lines = mapbox::geojson::multi_line_string{
-                {populate_points(coords, 0, coords.size() / dim, dim, e)}};
-        } else {
-            int lastIndex = 0;
-            auto ret = mapbox::geojson::multi_line_string{};
-            ret.reserve(lengths.size());
-            for (auto length : lengths) {
-                ret.push_back(mapbox::geojson::line_string{
-                    populate_points(coords, lastIndex, length, dim, e)});
-                lastIndex += length;
-            }
-            lines = std::move(ret);
-        }
-    };
-
-    auto populatePolygon = [&](mapbox::geojson::geometry &polygon,
-                               const std::vector<uint32_t> &lengths,
-                               const std::vector<int64_t> &coords) {
-        if (lengths.empty()) {
-            auto shell = mapbox::geojson::line_string{
-                populate_points(coords, 0, coords.size() / dim, dim, e, true)};
-            polygon = mapbox::geojson::polygon{{std::move(shell)}};
-        } else {
-            int lastIndex = 0;
-            auto ret = mapbox::geojson::polygon{};
-            ret.reserve(lengths.size());
-            for (auto length : lengths) {
-                ret.push_back(mapbox::geojson::line_string{
-                    populate_points(coords, lastIndex, length, dim, e, true)});
-                lastIndex += length;
-            }
-            polygon = std::move(ret);
-        }
-    };
-
-    auto populateMultiPolygon = [&](mapbox::geojson::geometry &polygons,
-                                    const std::vector<uint32_t> &lengths,
-                                    const std::vector<int64_t> &coords) {
-        if (lengths.empty()) {
-            auto shell = mapbox::geojson::line_string{
-                populate_points(coords, 0, coords.size() / dim, dim, e, true)};
-            polygons = mapbox::geojson::multi_polygon{{{std::move(shell)}}};
-        } else {
-            auto ret = mapbox::geojson::multi_polygon{};
-            int n_polygons = lengths[0];
-            ret.reserve(lengths[0]);
-            int lastIndex = 0;
-            // #polygons #ring ring1_size ring2_size ...
-            for (int i = 0, j = 1; i < n_polygons; i++) {
-                auto poly = mapbox::geojson::polygon{};
-                int n_rings = lengths[j++];
-                poly.reserve(n_rings);
-                for (int k = 0; k < n_rings; ++k) {
-                    int n_points = lengths[j++];
-                    auto ring = mapbox::geojson::line_string{populate_points(
-                        coords, lastIndex, n_points, dim, e, true)};
-                    poly.push_back(std::move(ring));
-                    lastIndex += n_points;
-                }
-                ret.push_back(std::move(poly));
-            }
-            polygons = std::move(ret);
-        }
-    };
-
+    // packed fields are only recorded, coordinates are decoded at the end of
+    // the message, straight from the buffer into the final point storage
+    protozero::iterator_range<Pbf::const_uint32_iterator> lengths;
+    protozero::data_view coords;
+    bool has_coords = false;
+    size_t n_geometries = 0;
     std::vector<mapbox::geojson::value> values;
-    std::vector<uint32_t> lengths;
-    mapbox::geojson::geometry g;
+    mapbox::feature::property_map custom_properties;
     while (pbf.next()) {
         const auto tag = pbf.tag();
         if (tag == 2) {
-            auto uint32s = pbf.get_packed_uint32();
-            lengths = std::vector<uint32_t>(uint32s.begin(), uint32s.end());
+            lengths = pbf.get_packed_uint32();
         } else if (tag == 3) {
-            auto int64s = pbf.get_packed_sint64();
-            auto coords = std::vector<int64_t>(int64s.begin(), int64s.end());
-            if (type == 0) {
-                populatePoint(g, coords);
-            } else if (type == 1) {
-                populateMultiPoint(g, coords);
-            } else if (type == 2) {
-                populateLineString(g, coords);
-            } else if (type == 3) {
-                populateMultiLineString(g, lengths, coords);
-            } else if (type == 4) {
-                populatePolygon(g, lengths, coords);
-            } else if (type == 5) {
-                populateMultiPolygon(g, lengths, coords);
-            } else if (type == 6) {
-                //
-            } else {
-                return g;
-            }
+            coords = pbf.get_view();
+            has_coords = true;
         } else if (tag == 4) {
-            if (!g.is<mapbox::geojson::geometry_collection>()) {
-                g = mapbox::geojson::geometry_collection{};
+            auto &geometries = refill<mapbox::geojson::geometry_collection>(g);
+            if (n_geometries == geometries.size()) {
+                geometries.emplace_back();
             }
             protozero::pbf_reader pbf_g = pbf.get_message();
-            g.get<mapbox::geojson::geometry_collection>().push_back(
-                readGeometry(pbf_g));
+            readGeometry(pbf_g, geometries[n_geometries++]);
         } else if (tag == 13) {
             protozero::pbf_reader pbf_v = pbf.get_message();
             values.push_back(readValue(pbf_v));
@@ -848,15 +1874,182 @@ mapbox::geojson::geometry Decoder::readGeometry(Pbf &pbf)
                 continue;
             }
             unpack_properties(
-                g.custom_properties,                                   //
+                custom_properties,                                     //
                 std::vector<uint32_t>(indexes.begin(), indexes.end()), //
                 keys, values);
         } else {
             pbf.skip();
         }
     }
-    return g;
+
+    if (has_coords && type <= 5) {
+        const char *data = coords.data();
+        const char *end = data + coords.size();
+        const double e = this->e;
+        const int dim = this->dim;
+        auto num_points = [&]() { return count_varints(coords) / dim; };
+        auto length = lengths.begin();
+        auto populate_lines = [&](auto &lines, bool closed) {
+            if (lengths.empty()) {
+                lines.resize(1);
+                populate_points(lines[0], data, end, num_points(), dim, e,
+                                closed);
+            } else {
+                lines.resize(lengths.size());
+                for (auto &line : lines) {
+                    populate_points(line, data, end, *length++, dim, e,
+                                    closed);
+                }
+            }
+        };
+        if (type == 0) {
+            auto &point = refill<mapbox::geojson::point>(g);
+            point = mapbox::geojson::point{};
+            double *p = &point.x;
+            for (int d = 0; d < dim && data != end; ++d) {
+                p[d] = protozero::decode_zigzag64(
+                           protozero::decode_varint(&data, end)) /
+                       e;
+            }
+        } else if (type == 1) {
+            populate_points(refill<mapbox::geojson::multi_point>(g), data,
+                            end, num_points(), dim, e);
+        } else if (type == 2) {
+            populate_points(refill<mapbox::geojson::line_string>(g), data,
+                            end, num_points(), dim, e);
+        } else if (type == 3) {
+            populate_lines(refill<mapbox::geojson::multi_line_string>(g),
+                           false);
+        } else if (type == 4) {
+            populate_lines(refill<mapbox::geojson::polygon>(g), true);
+        } else if (type == 5) {
+            auto &polygons = refill<mapbox::geojson::multi_polygon>(g);
+            if (lengths.empty()) {
+                polygons.resize(1);
+                polygons[0].resize(1);
+                populate_points(polygons[0][0], data, end, num_points(), dim,
+                                e, true);
+            } else {
+                // #polygons #ring ring1_size ring2_size ...
+                const size_t n_polygons = *length++;
+                size_t i = 0;
+                for (; i < n_polygons && length != lengths.end(); ++i) {
+                    if (i == polygons.size()) {
+                        polygons.emplace_back();
+                    }
+                    auto &polygon = polygons[i];
+                    const size_t n_rings = *length++;
+                    size_t k = 0;
+                    for (; k < n_rings && length != lengths.end(); ++k) {
+                        if (k == polygon.size()) {
+                            polygon.emplace_back();
+                        }
+                        populate_points(polygon[k], data, end, *length++,
+                                        dim, e, true);
+                    }
+                    polygon.resize(k);
+                }
+                polygons.resize(i);
+            }
+        }
+    } else if (n_geometries) {
+        g.get<mapbox::geojson::geometry_collection>().resize(n_geometries);
+    } else {
+        g = mapbox::geojson::geometry{};
+    }
+    if (!custom_properties.empty()) {
+        g.custom_properties = std::move(custom_properties);
+    }
+}
+// extend `extent` by `length` points (zigzag-ed deltas, packed) from
+// [data, end), quantized, only x and y
+static void extend_points(std::array<int64_t, 4> &extent, //
+                          const char *&data, const char *end, size_t length,
+                          int dim)
+{
+    int64_t x = 0, y = 0;
+    for (size_t i = 0; i < length && data != end; ++i) {
+        x += protozero::decode_zigzag64(protozero::decode_varint(&data, end));
+        y += protozero::decode_zigzag64(protozero::decode_varint(&data, end));
+        for (int d = 2; d < dim; ++d) {
+            protozero::skip_varint(&data, end);
+        }
+        extent[0] = std::min(extent[0], x);
+        extent[1] = std::min(extent[1], y);
+        extent[2] = std::max(extent[2], x);
+        extent[3] = std::max(extent[3], y);
+    }
+}
+
+void Decoder::readExtent(Pbf &pbf, std::array<int64_t, 4> &extent) const
+{
+    if (!pbf.next()) {
+        return;
+    }
+    const auto type = pbf.get_enum();
+    protozero::iterator_range<Pbf::const_uint32_iterator> lengths;
+    protozero::data_view coords;
+    bool has_coords = false;
+    while (pbf.next()) {
+        const auto tag = pbf.tag();
+        if (tag == 2) {
+            lengths = pbf.get_packed_uint32();
+        } else if (tag == 3) {
+            coords = pbf.get_view();
+            has_coords = true;
+        } else if (tag == 4) {
+            protozero::pbf_reader pbf_g = pbf.get_message();
+            readExtent(pbf_g, extent);
+        } else {
+            pbf.skip();
+        }
+    }
+    if (!has_coords || type > 5) {
+        return;
+    }
+    // same layout as in readGeometry, deltas restart with every line (ring)
+    const char *data = coords.data();
+    const char *end = data + coords.size();
+    auto length = lengths.begin();
+    if (type <= 2 || lengths.empty()) {
+        extend_points(extent, data, end, count_varints(coords) / dim, dim);
+    } else if (type == 5) {
+        // #polygons #ring ring1_size ring2_size ...
+        const int n_polygons = *length++;
+        for (int i = 0; i < n_polygons && length != lengths.end(); ++i) {
+            const int n_rings = *length++;
+            for (int k = 0; k < n_rings && length != lengths.end(); ++k) {
+                extend_points(extent, data, end, *length++, dim);
+            }
+        }
+    } else {
+        for (; length != lengths.end(); ++length) {
+            extend_points(extent, data, end, *length, dim);
+        }
+    }
 }
+
+bool Decoder::intersects(protozero::data_view feature,
+                         const std::array<double, 4> &bbox) const
+{
+    protozero::pbf_reader pbf{feature};
+    if (!pbf.next(1)) {
+        return false; // no geometry
+    }
+    protozero::pbf_reader pbf_g = pbf.get_message();
+    constexpr auto lowest = std::numeric_limits<int64_t>::lowest();
+    constexpr auto highest = std::numeric_limits<int64_t>::max();
+    auto extent = std::array<int64_t, 4>{highest, highest, lowest, lowest};
+    readExtent(pbf_g, extent);
+    if (extent[0] > extent[2]) {
+        return false; // no coordinates
+    }
+    // compared as decoded
+    const double e = this->e;
+    return extent[0] / e <= bbox[2] && extent[2] / e >= bbox[0] &&
+           extent[1] / e <= bbox[3] && extent[3] / e >= bbox[1];
+}
+
 mapbox::geojson::value Decoder::readValue(Pbf &pbf)
 {
     if (!pbf.next()) {
@@ -880,5 +2073,625 @@ mapbox::geojson::value Decoder::readValue(Pbf &pbf)
     }
     return {};
 }
+
+// q / 10^precision as a fixed-point decimal, without trailing zeros but with
+// at least one fraction digit ("120.0", like Writer::Double), returns the
+// length written to out (up to 22 chars)
+static size_t format_fixed(int64_t q, int precision, char *out)
+{
+    char *p = out;
+    uint64_t u = q < 0 ? 0 - static_cast<uint64_t>(q) : q;
+    if (q < 0) {
+        *p++ = '-';
+    }
+    char digits[20]; // reversed
+    int n = 0;
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (n <= precision) {
+        *p++ = '0';
+    }
+    for (int i = n - 1; i >= precision; --i) {
+        *p++ = digits[i];
+    }
+    *p++ = '.';
+    const int fraction = std::min(n, precision);
+    int last = 0; // lowest non-zero fraction digit
+    while (last < fraction && digits[last] == '0') {
+        ++last;
+    }
+    if (last == fraction) {
+        *p++ = '0';
+    } else {
+        for (int i = precision - 1; i >= last; --i) {
+            *p++ = i < n ? digits[i] : '0';
+        }
+    }
+    return p - out;
+}
+
+// Streaming geobuf -> GeoJSON text: the pbf is walked and written through a
+// rapidjson (Pretty)Writer, without geojson or json trees in between. Members
+// come in the order of mapbox::geojson::convert (type, id, geometry,
+// properties, then custom properties), with sort_keys every object has its
+// members sorted instead.
+template <typename Writer> struct GeojsonWriter
+{
+    using Pbf = protozero::pbf_reader;
+    enum Kind
+    {
+        TYPE,        // view: the type name
+        ID_STRING,   // view: the id
+        ID_INT,      // number: the id
+        GEOMETRY,    // view: geometry message, empty for null
+        PROPERTIES,  // begin, end: range in `properties`
+        VALUE,       // view: value message
+        FEATURES,    // view: feature collection message
+        GEOMETRIES,  // view: geometry (collection) message
+        COORDINATES, // number: geometry type, view: coords, lengths
+    };
+    // an object member, written once all of them are known (to sort them)
+    struct Member
+    {
+        protozero::data_view key{};
+        Kind kind = TYPE;
+        protozero::data_view view{};
+        protozero::data_view lengths{};
+        int64_t number = 0;
+        size_t begin = 0, end = 0;
+    };
+
+    GeojsonWriter(Decoder &decoder, Writer &writer, bool sort_keys)
+        : decoder(decoder), writer(writer), sort_keys(sort_keys)
+    {
+    }
+
+    void write(protozero::data_view pbf_bytes)
+    {
+        auto pbf = Pbf{pbf_bytes};
+        if (!decoder.readHeader(pbf)) {
+            writer.Null();
+            return;
+        }
+        precision = decoder.precision();
+        // fixed-point from 1e-6 on (where Writer::Double would too)
+        min_fixed = 1;
+        for (int i = 6; i < precision; ++i) {
+            min_fixed *= 10;
+        }
+        const auto tag = pbf.tag();
+        if (tag == 4) {
+            writeFeatureCollection(pbf.get_view());
+        } else if (tag == 5) {
+            writeFeature(pbf.get_view());
+        } else {
+            writeGeometry(pbf.get_view());
+        }
+    }
+
+  private:
+    static protozero::data_view name(const char *str)
+    {
+        return {str, std::strlen(str)};
+    }
+
+    // custom properties (tag 15) or properties (tag 14) of a message, the
+    // values (tag 13) come before them. `projected`: only the keys wanted by
+    // the decoder's projection (set_projection)
+    void addProperties(Pbf &pbf, std::vector<Member> &out,
+                       bool projected = false)
+    {
+        auto packed = pbf.get_packed_uint32();
+        if (packed.size() % 2 != 0) {
+            return;
+        }
+        const auto &keys = decoder.keys;
+        const auto &wanted_keys = decoder.wanted_keys;
+        for (auto it = packed.begin(); it != packed.end();) {
+            const auto key = *it++;
+            const auto value = *it++;
+            if (key >= keys.size() || value >= values.size()) {
+                continue;
+            }
+            if (projected && (key >= wanted_keys.size() || !wanted_keys[key])) {
+                continue;
+            }
+            Member member{{keys[key].data(), keys[key].size()}, VALUE};
+            member.view = values[value];
+            out.push_back(member);
+        }
+    }
+
+    // write members[begin, end) as an object, then drop them
+    void writeObject(size_t begin)
+    {
+        if (sort_keys) {
+            std::sort(members.begin() + begin, members.end(),
+                      [](const Member &lhs, const Member &rhs) {
+                          return lhs.key.compare(rhs.key) < 0;
+                      });
+        }
+        const size_t end = members.size();
+        writer.StartObject();
+        for (size_t i = begin; i < end; ++i) {
+            // copied, nested objects push to `members`
+            const Member member = members[i];
+            writer.Key(member.key.data(), member.key.size());
+            writeMember(member);
+        }
+        writer.EndObject();
+        members.resize(begin);
+    }
+
+    void writeMember(const Member &member)
+    {
+        switch (member.kind) {
+        case TYPE:
+        case ID_STRING:
+            writer.String(member.view.data(), member.view.size());
+            break;
+        case ID_INT:
+            writer.Int64(member.number);
+            break;
+        case GEOMETRY:
+            if (member.view.data()) {
+                writeGeometry(member.view);
+            } else {
+                writer.Null();
+            }
+            break;
+        case PROPERTIES: {
+            const size_t begin = members.size();
+            members.insert(members.end(), properties.begin() + member.begin,
+                           properties.begin() + member.end);
+            writeObject(begin);
+            break;
+        }
+        case VALUE:
+            writeValue(member.view);
+            break;
+        case FEATURES: {
+            writer.StartArray();
+            auto pbf = Pbf{member.view};
+            while (pbf.next(1)) {
+                writeFeature(pbf.get_view());
+            }
+            writer.EndArray();
+            break;
+        }
+        case GEOMETRIES: {
+            writer.StartArray();
+            auto pbf = Pbf{member.view};
+            while (pbf.next(4)) {
+                writeGeometry(pbf.get_view());
+            }
+            writer.EndArray();
+            break;
+        }
+        case COORDINATES:
+            writeCoordinates(member.number, member.view, member.lengths);
+            break;
+        }
+    }
+
+    void writeFeatureCollection(protozero::data_view message)
+    {
+        const size_t begin = members.size();
+        members.push_back({name("type"), TYPE, name("FeatureCollection")});
+        members.push_back({name("features"), FEATURES, message});
+        // features are skipped here, written from the FEATURES member
+        values.clear();
+        auto pbf = Pbf{message};
+        while (pbf.next()) {
+            const auto tag = pbf.tag();
+            if (tag == 13) {
+                values.push_back(pbf.get_view());
+            } else if (tag == 15) {
+                addProperties(pbf, members);
+            } else {
+                pbf.skip();
+            }
+        }
+        writeObject(begin);
+    }
+
+    void writeFeature(protozero::data_view message)
+    {
+        // type, id, geometry, properties, then the custom properties
+        const size_t begin = members.size();
+        members.push_back({name("type"), TYPE, name("Feature")});
+        members.push_back({name("id"), ID_STRING});
+        members.push_back({name("geometry"), GEOMETRY});
+        members.push_back({name("properties"), PROPERTIES});
+        bool has_id = false;
+        properties.clear();
+        values.clear();
+        auto pbf = Pbf{message};
+        const bool projected = decoder.wanted_properties.has_value();
+        while (pbf.next()) {
+            const auto tag = pbf.tag();
+            if (tag == 1) {
+                if (decoder.wanted_geometry) {
+                    members[begin + 2].view = pbf.get_view();
+                } else {
+                    pbf.skip(); // "geometry": null
+                }
+            } else if (tag == 11) {
+                members[begin + 1].kind = ID_STRING;
+                members[begin + 1].view = pbf.get_view();
+                has_id = true;
+            } else if (tag == 12) {
+                members[begin + 1].kind = ID_INT;
+                members[begin + 1].number = pbf.get_int64();
+                has_id = true;
+            } else if (tag == 13) {
+                // only a view, values of dropped keys are never decoded
+                values.push_back(pbf.get_view());
+            } else if (tag == 14) {
+                // projected like Decoder::readFeature, custom properties
+                // are always kept
+                addProperties(pbf, properties, projected);
+            } else if (tag == 15) {
+                addProperties(pbf, members);
+            } else {
+                pbf.skip();
+            }
+        }
+        members[begin + 3].end = properties.size();
+        if (!has_id) {
+            members.erase(members.begin() + begin + 1);
+        }
+        writeObject(begin);
+    }
+
+    void writeGeometry(protozero::data_view message)
+    {
+        auto pbf = Pbf{message};
+        if (!pbf.next()) {
+            writer.Null();
+            return;
+        }
+        const auto type = pbf.get_enum();
+        Member coordinates{name("coordinates"), COORDINATES};
+        coordinates.number = type;
+        bool has_coords = false;
+        bool has_geometries = false;
+        const size_t begin = members.size();
+        members.emplace_back(); // type
+        members.emplace_back(); // coordinates or geometries
+        values.clear();
+        while (pbf.next()) {
+            const auto tag = pbf.tag();
+            if (tag == 2) {
+                coordinates.lengths = pbf.get_view();
+            } else if (tag == 3) {
+                coordinates.view = pbf.get_view();
+                has_coords = true;
+            } else if (tag == 4) {
+                has_geometries = true;
+                pbf.skip();
+            } else if (tag == 13) {
+                values.push_back(pbf.get_view());
+            } else if (tag == 15) {
+                addProperties(pbf, members);
+            } else {
+                pbf.skip();
+            }
+        }
+        static const char *names[] = {"Point",           "MultiPoint",
+                                      "LineString",      "MultiLineString",
+                                      "Polygon",         "MultiPolygon"};
+        if (has_coords && type >= 0 && type <= 5) {
+            members[begin] = {name("type"), TYPE, name(names[type])};
+            members[begin + 1] = coordinates;
+        } else if (has_geometries) {
+            members[begin] = {name("type"), TYPE, name("GeometryCollection")};
+            members[begin + 1] = {name("geometries"), GEOMETRIES, message};
+        } else {
+            // empty geometry
+            members.resize(begin);
+            writer.Null();
+            return;
+        }
+        writeObject(begin);
+    }
+
+    void writeValue(protozero::data_view message)
+    {
+        auto pbf = Pbf{message};
+        if (!pbf.next()) {
+            writer.Null();
+            return;
+        }
+        const auto tag = pbf.tag();
+        if (tag == 1) {
+            auto view = pbf.get_view();
+            writer.String(view.data(), view.size());
+        } else if (tag == 2) {
+            writer.Double(pbf.get_double());
+        } else if (tag == 3) {
+            writer.Uint64(pbf.get_uint64());
+        } else if (tag == 4) {
+            writer.Int64(static_cast<int64_t>(-pbf.get_uint64()));
+        } else if (tag == 5) {
+            writer.Bool(pbf.get_bool());
+        } else if (tag == 6) {
+            auto json = parse(pbf.get_string());
+            if (sort_keys) {
+                sort_keys_inplace(json);
+            }
+            json.Accept(writer);
+        } else {
+            writer.Null();
+        }
+    }
+
+    // a decoded coordinate is q / 10^precision, written as a fixed-point
+    // decimal straight from q (no shortest round trip search), it parses back
+    // to exactly that double. Below 1e-6 (exponent notation) and huge values
+    // are left to Writer::Double.
+    void writeCoordinate(int64_t q)
+    {
+        if constexpr (std::is_base_of_v<JsonHandler, Writer>) {
+            // no text in between, the double as Decoder::decode has it
+            writer.Double(q / static_cast<double>(decoder.e));
+        } else {
+            const uint64_t u = q < 0 ? 0 - static_cast<uint64_t>(q) : q;
+            if (u != 0 && (u < min_fixed || u >= MAX_FIXED)) {
+                writer.Double(q / static_cast<double>(decoder.e));
+                return;
+            }
+            char buffer[32];
+            const size_t length = format_fixed(q, precision, buffer);
+            writer.RawValue(buffer, length, rapidjson::kNumberType);
+        }
+    }
+
+    void writePoint(const int64_t *xyz)
+    {
+        writer.StartArray();
+        writeCoordinate(xyz[0]);
+        writeCoordinate(xyz[1]);
+        if (xyz[2] != 0) {
+            writeCoordinate(xyz[2]);
+        }
+        writer.EndArray();
+    }
+
+    // same as populate_points, points past the end of the data are zeros
+    void writePoints(const char *&data, const char *end, size_t length,
+                     bool closed = false)
+    {
+        const int dim = decoder.dim;
+        int64_t prev[3] = {0, 0, 0};
+        int64_t first[3] = {0, 0, 0};
+        writer.StartArray();
+        for (size_t i = 0; i < length; ++i) {
+            int64_t xyz[3] = {0, 0, 0};
+            if (data != end) {
+                for (int d = 0; d < dim; ++d) {
+                    prev[d] += protozero::decode_zigzag64(
+                        protozero::decode_varint(&data, end));
+                    xyz[d] = prev[d];
+                }
+            }
+            if (i == 0) {
+                std::copy(xyz, xyz + 3, first);
+            }
+            writePoint(xyz);
+        }
+        if (closed) {
+            writePoint(first);
+        }
+        writer.EndArray();
+    }
+
+    // same layout as in Decoder::readGeometry
+    void writeCoordinates(int type, protozero::data_view coords,
+                          protozero::data_view packed_lengths)
+    {
+        const char *data = coords.data();
+        const char *end = data + coords.size();
+        const auto num_points = count_varints(coords) / decoder.dim;
+        auto length = Pbf::const_uint32_iterator{
+            packed_lengths.data(),
+            packed_lengths.data() + packed_lengths.size()};
+        const auto lengths_end = Pbf::const_uint32_iterator{
+            packed_lengths.data() + packed_lengths.size(),
+            packed_lengths.data() + packed_lengths.size()};
+        const bool no_lengths = length == lengths_end;
+        if (type == 0) {
+            int64_t xyz[3] = {0, 0, 0};
+            for (int d = 0; d < static_cast<int>(decoder.dim) && data != end;
+                 ++d) {
+                xyz[d] = protozero::decode_zigzag64(
+                    protozero::decode_varint(&data, end));
+            }
+            writePoint(xyz);
+        } else if (type == 1 || type == 2) {
+            writePoints(data, end, num_points);
+        } else if (type == 3 || type == 4) {
+            const bool closed = type == 4;
+            writer.StartArray();
+            if (no_lengths) {
+                writePoints(data, end, num_points, closed);
+            }
+            for (; length != lengths_end; ++length) {
+                writePoints(data, end, *length, closed);
+            }
+            writer.EndArray();
+        } else if (type == 5) {
+            writer.StartArray();
+            if (no_lengths) {
+                writer.StartArray();
+                writePoints(data, end, num_points, true);
+                writer.EndArray();
+            } else {
+                // #polygons #ring ring1_size ring2_size ...
+                const int n_polygons = *length++;
+                for (int i = 0; i < n_polygons && length != lengths_end;
+                     ++i) {
+                    writer.StartArray();
+                    const int n_rings = *length++;
+                    for (int k = 0; k < n_rings && length != lengths_end;
+                         ++k) {
+                        writePoints(data, end, *length++, true);
+                    }
+                    writer.EndArray();
+                }
+            }
+            writer.EndArray();
+        }
+    }
+
+    // well below 2^53, q converts to double exactly (as in Decoder)
+    static constexpr uint64_t MAX_FIXED = 1000000000000000ULL;
+
+    Decoder &decoder;
+    Writer &writer;
+    const bool sort_keys;
+    int precision = 0;
+    uint64_t min_fixed = 1;
+    // scratch, reused across features
+    std::vector<Member> members;    // of the objects being written
+    std::vector<Member> properties; // of the feature being written
+    std::vector<protozero::data_view> values; // of the message being read
+};
+
+bool Decoder::decode_to_json(protozero::data_view pbf_bytes, std::FILE *fp,
+                             bool indent, bool sort_keys)
+{
+    using namespace rapidjson;
+    char writeBuffer[65536];
+    FileWriteStream os(fp, writeBuffer, sizeof(writeBuffer));
+    if (indent) {
+        PrettyWriter<FileWriteStream> writer(os);
+        GeojsonWriter<decltype(writer)>(*this, writer, sort_keys)
+            .write(pbf_bytes);
+    } else {
+        Writer<FileWriteStream> writer(os);
+        GeojsonWriter<decltype(writer)>(*this, writer, sort_keys)
+            .write(pbf_bytes);
+    }
+    os.Flush();
+    return !ferror(fp);
+}
+
+bool Decoder::decode_to_json(protozero::data_view pbf_bytes,
+                             const std::string &output_path, bool indent,
+                             bool sort_keys)
+{
+    std::unique_ptr<FILE, decltype(&fclose)> fp(
+        fopen(output_path.c_str(), "wb"), &fclose);
+    if (!fp) {
+        return false;
+    }
+    const bool written =
+        decode_to_json(pbf_bytes, fp.get(), indent, sort_keys);
+    return fclose(fp.release()) == 0 && written;
+}
+
+void Decoder::decode_to_handler(protozero::data_view pbf_bytes,
+                                JsonHandler &handler)
+{
+    GeojsonWriter<JsonHandler>(*this, handler, false).write(pbf_bytes);
+}
+
+GeobufReader::GeobufReader(std::string bytes) : bytes(std::move(bytes))
+{
+    auto pbf = protozero::pbf_reader{this->bytes};
+    auto add_offset = [&](protozero::data_view view) {
+        offsets.emplace_back(view.data() - this->bytes.data(), view.size());
+    };
+    if (decoder.readHeader(pbf)) {
+        const auto tag = pbf.tag();
+        if (tag == 4) {
+            // features are not decoded, fc custom properties are
+            protozero::pbf_reader pbf_fc = pbf.get_message();
+            std::vector<mapbox::geojson::value> values;
+            while (pbf_fc.next()) {
+                const auto tag = pbf_fc.tag();
+                if (tag == 1) {
+                    add_offset(pbf_fc.get_view());
+                } else if (tag == 13) {
+                    protozero::pbf_reader pbf_v = pbf_fc.get_message();
+                    values.push_back(decoder.readValue(pbf_v));
+                } else if (tag == 15) {
+                    auto indexes = pbf_fc.get_packed_uint32();
+                    if (indexes.size() % 2 != 0) {
+                        continue;
+                    }
+                    unpack_properties(custom_properties_,
+                                      std::vector<uint32_t>(indexes.begin(),
+                                                            indexes.end()),
+                                      decoder.keys, values);
+                } else {
+                    pbf_fc.skip();
+                }
+            }
+        } else if (tag == 5) {
+            add_offset(pbf.get_view());
+        }
+    }
+}
+
+protozero::pbf_reader GeobufReader::message(size_t index) const
+{
+    if (index >= offsets.size()) {
+        throw std::out_of_range("feature index " + std::to_string(index) +
+                                " out of range [0, " +
+                                std::to_string(offsets.size()) + ")");
+    }
+    auto &offset = offsets[index];
+    return protozero::pbf_reader{bytes.data() + offset.first, offset.second};
+}
+
+mapbox::geojson::feature GeobufReader::feature(size_t index)
+{
+    auto pbf = message(index);
+    return decoder.readFeature(pbf);
+}
+
+mapbox::geojson::geometry GeobufReader::geometry(size_t index)
+{
+    auto pbf = message(index);
+    while (pbf.next()) {
+        if (pbf.tag() == 1) {
+            protozero::pbf_reader pbf_g = pbf.get_message();
+            return decoder.readGeometry(pbf_g);
+        }
+        pbf.skip();
+    }
+    return {};
+}
+
+mapbox::feature::property_map GeobufReader::properties(size_t index)
+{
+    auto pbf = message(index);
+    mapbox::feature::property_map props;
+    std::vector<mapbox::geojson::value> values;
+    while (pbf.next()) {
+        const auto tag = pbf.tag();
+        if (tag == 13) {
+            protozero::pbf_reader pbf_v = pbf.get_message();
+            values.push_back(decoder.readValue(pbf_v));
+        } else if (tag == 14) {
+            auto indexes = pbf.get_packed_uint32();
+            if (indexes.size() % 2 != 0) {
+                continue;
+            }
+            unpack_properties(
+                props,                                                 //
+                std::vector<uint32_t>(indexes.begin(), indexes.end()), //
+                decoder.keys, values);
+        } else {
+            // geometry is skipped, not decoded
+            pbf.skip();
+        }
+    }
+    return props;
+}
 } // namespace geobuf
 } // namespace mapbox
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <array>
 #include <cmath>
+#include <cstdio>
+#include <functional>
 #include <mapbox/geojson.hpp>
 #include <mapbox/geojson/rapidjson.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <protozero/pbf_builder.hpp>
 #include <protozero/pbf_reader.hpp>
+#include <unordered_set>
 
 #define MAPBOX_GEOBUF_DEFAULT_PRECISION 6
 #define MAPBOX_GEOBUF_DEFAULT_DIM 2
@@ -22,6 +29,10 @@ using RapidjsonAllocator = mapbox::geojson::rapidjson_allocator;
 
 RapidjsonValue load_json(const std::string &path);
 RapidjsonValue load_json(); // read from stdin
+// in-situ parsing over a private mapping of the file, strings are not copied
+// but point into the mapped pages, which live as long as the returned value
+// (and so do those of plain copies, rapidjson doesn't copy const strings)
+std::shared_ptr<RapidjsonValue> load_json_insitu(const std::string &path);
 bool dump_json(const std::string &path, const RapidjsonValue &json,
                bool indent = false, bool sort_keys = false);
 bool dump_json(const RapidjsonValue &json, //
@@ -32,6 +43,32 @@ std::string load_bytes(const std::string &path);
 std::string load_bytes(); // read from stdin
 bool dump_bytes(const std::string &path, const std::string &bytes);
 
+// A whole file, read-only and memory-mapped (read into memory where mmap is
+// not available), to decode straight over the mapped pages.
+// If `writable`, the mapping is private (copy-on-write, nothing goes back to
+// the file) and is followed by a '\0', as in-situ parsing needs.
+struct MappedFile
+{
+    explicit MappedFile(const std::string &path, bool writable = false);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // false if the file couldn't be opened
+    explicit operator bool() const { return opened; }
+    const char *data() const { return data_; }
+    char *data() { return data_; } // only if writable
+    size_t size() const { return size_; }
+    protozero::data_view view() const { return {data_, size_}; }
+
+  private:
+    bool opened = false;
+    bool mapped = false;
+    char *data_ = nullptr;
+    size_t size_ = 0;
+    std::string buffer; // if not mapped
+};
+
 RapidjsonValue geojson2json(const mapbox::geojson::value &geojson,
                             bool sort_keys = false);
 RapidjsonValue geojson2json(const mapbox::geojson::geojson &geojson,
@@ -73,12 +110,21 @@ inline RapidjsonValue sort_keys(const RapidjsonValue &json)
     return copy;
 }
 
+// A mutex for an otherwise copyable object, copies get a mutex of their own.
+struct InstanceMutex : std::mutex
+{
+    InstanceMutex() = default;
+    InstanceMutex(const InstanceMutex &) : std::mutex() {}
+    InstanceMutex &operator=(const InstanceMutex &) { return *this; }
+};
+
 struct Encoder
 {
     using Pbf = protozero::pbf_writer;
     Encoder(uint32_t maxPrecision = std::pow(10,
-                                             MAPBOX_GEOBUF_DEFAULT_PRECISION))
-        : maxPrecision(maxPrecision)
+                                             MAPBOX_GEOBUF_DEFAULT_PRECISION),
+            int threads = 1)
+        : maxPrecision(maxPrecision), threads(threads)
     {
     }
     std::string encode(const mapbox::geojson::geojson &geojson);
@@ -97,10 +143,25 @@ struct Encoder
 
     std::string encode(const std::string &geojson);
     std::string encode(const RapidjsonValue &json);
+    // streaming (SAX) encoding in two passes, peak memory depends on the
+    // largest feature, not on the file size. Keys are tabled in document
+    // order: decodes to the same GeoJSON as encode(json), but is not
+    // byte-identical to it
     bool encode(const std::string &input_path, const std::string &output_path);
+    // each of them encoded on its own (same as encode), spread over `threads`
+    // threads, results in input order
+    std::vector<std::string>
+    encode_many(const std::vector<mapbox::geojson::geojson> &geojsons);
+
+    // An encoder keeps per-call state (keys, scratch buffers), callers
+    // sharing one between threads hold this around each call (not taken by
+    // the encoder itself).
+    mutable InstanceMutex mutex;
 
   private:
     void analyze(const mapbox::geojson::geojson &geojson);
+    void analyzeFeatures(const std::vector<mapbox::geojson::feature> &fc);
+    void analyzeFeature(const mapbox::geojson::feature &feature);
     void analyzeGeometry(const mapbox::geojson::geometry &geometry);
     void analyzeMultiLine(const LinesType &lines);
     void analyzePoints(const PointsType &points);
@@ -108,11 +169,18 @@ struct Encoder
     void saveKey(const std::string &key);
     void saveKey(const mapbox::feature::property_map &props);
 
+    // keys, dim, precision
+    void writeHeader(Pbf &pbf);
     // Yeah, I know. In c++, we can use overloading...
     // Just make it identical to the JS implementation
     void
     writeFeatureCollection(const mapbox::geojson::feature_collection &geojson,
                            Pbf &pbf);
+    // feature (geometry) as submessage `tag` of pbf, sized before written
+    void writeFeature(const mapbox::geojson::feature &geojson, Pbf &pbf,
+                      int tag);
+    void writeGeometry(const mapbox::geojson::geometry &geojson, Pbf &pbf,
+                       int tag);
     void writeFeature(const mapbox::geojson::feature &geojson, Pbf &pbf);
     void writeGeometry(const mapbox::geojson::geometry &geojson, Pbf &pbf);
     // in mapbox geojson, there is no custom properties
@@ -124,37 +192,194 @@ struct Encoder
     // implict close=false is JS, we don't do that
     void writeMultiLine(const LinesType &lines, Pbf &pbf, bool closed);
     void writeMultiPolygon(const PolygonsType &polygons, Pbf &pbf);
-    std::vector<int64_t> populateLine(const PointsType &line, bool closed);
-    void populateLine(std::vector<int64_t> &coords, //
-                      const PointsType &line,       //
+    void populateLine(protozero::packed_field_uint64 &coords, //
+                      const PointsType &line,                 //
                       bool closed);
 
+    // Sizing pass, mirrors write*: returns the encoded size, caches sizes of
+    // nested geometries, coordinates and values in pre-order for write* to
+    // consume, so every submessage length is written once and nothing gets
+    // memmoved. Coordinates are quantized and non-scalar values dumped here
+    // only, write* reuses them. sizeFeature resets the cache (clearSizes).
+    void clearSizes();
+    size_t sizeFeature(const mapbox::geojson::feature &feature);
+    size_t sizeGeometry(const mapbox::geojson::geometry &geometry);
+    size_t sizeProps(const mapbox::feature::property_map &props, int tag);
+    size_t sizeValue(const mapbox::feature::value &value);
+    size_t sizeLine(const PointsType &line, bool closed = false);
+    size_t sizeMultiLine(const LinesType &lines, bool closed);
+    size_t sizeMultiPolygon(const PolygonsType &polygons);
+
     const uint32_t maxPrecision;
+    // #threads for analyzing & encoding features of a feature collection
+    const int threads;
     uint32_t dim = MAPBOX_GEOBUF_DEFAULT_DIM;
     uint32_t e = 1;
     std::unordered_map<std::string, std::uint32_t> keys;
+    // scratch buffers, reused across features (no allocation per feature)
+    std::vector<std::uint32_t> indexes; // props
+    std::vector<std::uint32_t> lengths; // multi line, multi polygon
+    std::vector<size_t> sizes;          // sizing pass
+    size_t next_size = 0;
+    std::vector<std::string> dumped; // non-scalar values and ids, as json
+    size_t next_dumped = 0;
+    std::vector<uint64_t> quantized; // zigzag-ed deltas, as written
+    size_t next_quantized = 0;
+};
+
+// Receives the decoded GeoJSON as SAX events (the rapidjson Handler concept,
+// with virtual calls), to build some other representation of it without a
+// geojson or json tree in between. Coordinates come as Double.
+struct JsonHandler
+{
+    using SizeType = rapidjson::SizeType;
+    virtual ~JsonHandler() = default;
+    virtual bool Null() = 0;
+    virtual bool Bool(bool b) = 0;
+    virtual bool Int(int i) { return Int64(i); }
+    virtual bool Uint(unsigned u) { return Uint64(u); }
+    virtual bool Int64(int64_t i) = 0;
+    virtual bool Uint64(uint64_t u) = 0;
+    virtual bool Double(double d) = 0;
+    virtual bool String(const char *str, SizeType length,
+                        bool copy = false) = 0;
+    virtual bool StartObject() = 0;
+    virtual bool Key(const char *str, SizeType length, bool copy = false) = 0;
+    virtual bool EndObject(SizeType memberCount = 0) = 0;
+    virtual bool StartArray() = 0;
+    virtual bool EndArray(SizeType elementCount = 0) = 0;
 };
 
 struct Decoder
 {
     using Pbf = protozero::pbf_reader;
-    Decoder() {}
-    static std::string to_printable(const std::string &pbf_bytes,
+    Decoder(int threads = 1) : threads(threads) {}
+    static std::string to_printable(protozero::data_view pbf_bytes,
                                     const std::string &indent = "");
-    mapbox::geojson::geojson decode(const std::string &pbf_bytes);
+    mapbox::geojson::geojson decode(protozero::data_view pbf_bytes);
+    // decoded over the memory-mapped file
+    mapbox::geojson::geojson decode_file(const std::string &path);
+    // feature-at-a-time (visitor) decoding of a feature collection (or a
+    // single feature), on_feature returns false to stop early. The feature
+    // is reused between calls (its coordinates and properties refilled in
+    // place), move from it to keep it.
+    bool decode(protozero::data_view pbf_bytes,
+                const std::function<bool(mapbox::geojson::feature &)>
+                    &on_feature);
     bool decode(const std::string &input_path, const std::string &output_path,
                 bool indent = false, bool sort_keys = false);
+    // streaming geobuf -> GeoJSON text, written as the pbf is walked (no
+    // geojson/json trees in between), fp is not closed. false on write
+    // errors (ferror, or closing output_path)
+    bool decode_to_json(protozero::data_view pbf_bytes, std::FILE *fp,
+                        bool indent = false, bool sort_keys = false);
+    bool decode_to_json(protozero::data_view pbf_bytes,
+                        const std::string &output_path, bool indent = false,
+                        bool sort_keys = false);
+    // same walk as decode_to_json, into handler (members in the same order)
+    void decode_to_handler(protozero::data_view pbf_bytes,
+                           JsonHandler &handler);
+    // each of them decoded on its own (same as decode, with the projection),
+    // spread over `threads` threads, results in input order
+    std::vector<mapbox::geojson::geojson>
+    decode_many(const std::vector<protozero::data_view> &pbf_bytes);
+    // only the features whose geometry intersects bbox (minx, miny, maxx,
+    // maxy), the others are dropped before any of them is decoded
+    mapbox::geojson::feature_collection
+    decode(protozero::data_view pbf_bytes, const std::array<double, 4> &bbox);
     int precision() const { return std::log10(e); }
+    // projection: decode only properties with these keys (all of them if
+    // nullopt) and geometries only if `geometry`, the rest is skipped. For
+    // every decode*, including decode_to_json/decode_to_handler (a dropped
+    // geometry is written as null)
+    void set_projection(
+        const std::optional<std::vector<std::string>> &properties,
+        bool geometry = true);
+
+    // Same as Encoder::mutex, also for set_projection (read by decode*).
+    mutable InstanceMutex mutex;
 
   private:
-    mapbox::geojson::feature_collection readFeatureCollection(Pbf &pbf);
+    friend struct GeobufReader;
+    friend struct FeatureCursor;
+    template <typename Writer> friend struct GeojsonWriter;
+    mapbox::geojson::feature_collection
+    readFeatureCollection(Pbf &pbf,
+                          const std::array<double, 4> *bbox = nullptr);
     mapbox::geojson::feature readFeature(Pbf &pbf);
+    void readFeature(Pbf &pbf, mapbox::geojson::feature &feature);
     mapbox::geojson::geometry readGeometry(Pbf &pbf);
+    // into g, reusing its lines/rings/points where it has the same type
+    void readGeometry(Pbf &pbf, mapbox::geojson::geometry &g);
     mapbox::geojson::value readValue(Pbf &pbf);
+    // extent of quantized coordinates (minx, miny, maxx, maxy), extended
+    // without decoding the geometry
+    void readExtent(Pbf &pbf, std::array<int64_t, 4> &extent) const;
+    bool intersects(protozero::data_view feature,
+                    const std::array<double, 4> &bbox) const;
+    // keys, dim, precision, returns the first non-header field (if any)
+    bool readHeader(Pbf &pbf);
 
+    // #threads for decoding features of a feature collection
+    const int threads;
+    std::optional<std::unordered_set<std::string>> wanted_properties;
+    bool wanted_geometry = true;
+    std::vector<bool> wanted_keys;   // by key index, set by readHeader
+    std::vector<bool> wanted_values; // by value index, of the feature
     uint32_t dim = MAPBOX_GEOBUF_DEFAULT_DIM;
     uint32_t e = std::pow(10, MAPBOX_GEOBUF_DEFAULT_PRECISION);
     std::vector<std::string> keys;
+    // scratch buffers, reused across features
+    std::vector<mapbox::geojson::value> values;
+    std::vector<uint32_t> indexes;
+};
+
+// Pull-style counterpart of the visitor decode: the features of a geobuf
+// (feature collection or single feature) one at a time, decoded with the
+// projection of `decoder` (copied) into a reused feature. Nothing is copied
+// from pbf_bytes, it must outlive the cursor.
+struct FeatureCursor
+{
+    FeatureCursor(const Decoder &decoder, protozero::data_view pbf_bytes);
+    // the next feature, valid until the next call, nullptr at the end
+    mapbox::geojson::feature *next();
+
+  private:
+    Decoder decoder;
+    protozero::pbf_reader features; // of the feature collection
+    protozero::data_view single{};  // a single feature, until read
+    mapbox::geojson::feature feature;
+};
+
+// Random access to features of a geobuf (feature collection or single
+// feature). Only feature boundaries are scanned on construction, each
+// lookup decodes just that feature (or its geometry/properties).
+struct GeobufReader
+{
+    explicit GeobufReader(std::string bytes);
+
+    size_t size() const { return offsets.size(); }
+    mapbox::geojson::feature feature(size_t index);
+    mapbox::geojson::geometry geometry(size_t index);
+    mapbox::feature::property_map properties(size_t index);
+
+    const std::vector<std::string> &keys() const { return decoder.keys; }
+    int dim() const { return decoder.dim; }
+    int precision() const { return decoder.precision(); }
+    // of the feature collection
+    const mapbox::feature::property_map &custom_properties() const
+    {
+        return custom_properties_;
+    }
+
+  private:
+    protozero::pbf_reader message(size_t index) const;
+
+    std::string bytes;
+    // offset & length of every feature message in bytes
+    std::vector<std::pair<size_t, size_t>> offsets;
+    mapbox::feature::property_map custom_properties_;
+    Decoder decoder;
 };
 
 } // namespace geobuf
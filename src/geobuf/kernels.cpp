@@ -0,0 +1,404 @@
+#include "geobuf/kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <protozero/exception.hpp>
+#include <protozero/varint.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define GEOBUF_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace mapbox
+{
+namespace geobuf
+{
+namespace kernels
+{
+static inline uint64_t zigzag(int64_t n)
+{
+    return (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63);
+}
+
+static void quantize_delta_zigzag_scalar(const double *xyz, size_t n, int dim,
+                                         double e, int64_t *prev,
+                                         uint64_t *out)
+{
+    for (size_t i = 0; i < n; ++i, xyz += 3) {
+        for (int d = 0; d < dim; ++d) {
+            auto q = static_cast<int64_t>(std::round(xyz[d] * e));
+            *out++ = zigzag(q - prev[d]);
+            prev[d] = q;
+        }
+    }
+}
+
+// out[k] = zigzag(q[k] - q[k - dim]) in place, back to front so q[k - dim]
+// is still there when needed, the first point is relative to `prev`
+static void delta_zigzag_tail(uint64_t *out, size_t k, int dim,
+                              const int64_t *prev)
+{
+    while (k > 0) {
+        --k;
+        auto q = static_cast<int64_t>(out[k]);
+        auto p = k >= static_cast<size_t>(dim)
+                     ? static_cast<int64_t>(out[k - dim])
+                     : prev[k];
+        out[k] = zigzag(q - p);
+    }
+}
+
+// save the last quantized point (before it gets delta-encoded)
+static void save_last(const uint64_t *out, size_t m, int dim, int64_t *last)
+{
+    for (int d = 0; d < dim; ++d) {
+        last[d] = static_cast<int64_t>(out[m - dim + d]);
+    }
+}
+
+#ifdef GEOBUF_KERNELS_X86
+// 1.5 * 2^52, adding it to an integral double |r| < 2^51 leaves r (two's
+// complement) in the low bits of the mantissa
+static constexpr double MAGIC = 6755399441055744.0;
+static constexpr double LIMIT = 2251799813685248.0; // 2^51
+
+// std::round (half away from zero) then to int64, lanes out of range (or NaN)
+// are flagged in `bad`
+__attribute__((target("avx2"))) static inline __m256i
+round_to_int64_avx2(__m256d v, __m256d &bad)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d magic = _mm256_set1_pd(MAGIC);
+    __m256d t = _mm256_round_pd(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256d frac = _mm256_andnot_pd(sign, _mm256_sub_pd(v, t)); // exact
+    __m256d up = _mm256_cmp_pd(frac, _mm256_set1_pd(0.5), _CMP_GE_OQ);
+    __m256d one = _mm256_or_pd(_mm256_set1_pd(1.0), _mm256_and_pd(v, sign));
+    __m256d r = _mm256_add_pd(t, _mm256_and_pd(up, one));
+    bad = _mm256_or_pd(bad, _mm256_cmp_pd(_mm256_andnot_pd(sign, r),
+                                          _mm256_set1_pd(LIMIT), _CMP_NLT_UQ));
+    return _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(r, magic)),
+                            _mm256_castpd_si256(magic));
+}
+
+__attribute__((target("avx2"))) static void
+quantize_delta_zigzag_avx2(const double *xyz, size_t n, int dim, double e,
+                           int64_t *prev, uint64_t *out)
+{
+    if (dim != 2 && dim != 3) {
+        return quantize_delta_zigzag_scalar(xyz, n, dim, e, prev, out);
+    }
+    if (n == 0) {
+        return;
+    }
+    const size_t m = n * dim;
+    const __m256d scale = _mm256_set1_pd(e);
+    __m256d bad = _mm256_setzero_pd();
+    size_t k = 0;
+    if (dim == 3) {
+        // xyz is contiguous
+        for (; k + 4 <= m; k += 4) {
+            __m256d v = _mm256_mul_pd(_mm256_loadu_pd(xyz + k), scale);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + k),
+                                round_to_int64_avx2(v, bad));
+        }
+    } else {
+        // xy of two points
+        for (; k + 4 <= m; k += 4) {
+            const double *p = xyz + k / 2 * 3;
+            __m256d v = _mm256_insertf128_pd(
+                _mm256_castpd128_pd256(_mm_loadu_pd(p)), _mm_loadu_pd(p + 3),
+                1);
+            v = _mm256_mul_pd(v, scale);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + k),
+                                round_to_int64_avx2(v, bad));
+        }
+    }
+    if (_mm256_movemask_pd(bad)) {
+        return quantize_delta_zigzag_scalar(xyz, n, dim, e, prev, out);
+    }
+    for (; k < m; ++k) {
+        double x = xyz[k / dim * 3 + k % dim];
+        out[k] = static_cast<uint64_t>(static_cast<int64_t>(std::round(x * e)));
+    }
+
+    int64_t last[3];
+    save_last(out, m, dim, last);
+    const __m256i zero = _mm256_setzero_si256();
+    k = m;
+    while (k >= static_cast<size_t>(dim) + 4) {
+        k -= 4;
+        __m256i cur =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(out + k));
+        __m256i before =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(out + k - dim));
+        __m256i d = _mm256_sub_epi64(cur, before);
+        __m256i zz = _mm256_xor_si256(_mm256_slli_epi64(d, 1),
+                                      _mm256_cmpgt_epi64(zero, d));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + k), zz);
+    }
+    delta_zigzag_tail(out, k, dim, prev);
+    std::copy(last, last + dim, prev);
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i
+round_to_int64_sse41(__m128d v, __m128d &bad)
+{
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d magic = _mm_set1_pd(MAGIC);
+    __m128d t = _mm_round_pd(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m128d frac = _mm_andnot_pd(sign, _mm_sub_pd(v, t)); // exact
+    __m128d up = _mm_cmpge_pd(frac, _mm_set1_pd(0.5));
+    __m128d one = _mm_or_pd(_mm_set1_pd(1.0), _mm_and_pd(v, sign));
+    __m128d r = _mm_add_pd(t, _mm_and_pd(up, one));
+    bad = _mm_or_pd(bad,
+                    _mm_cmpnlt_pd(_mm_andnot_pd(sign, r), _mm_set1_pd(LIMIT)));
+    return _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(r, magic)),
+                         _mm_castpd_si128(magic));
+}
+
+__attribute__((target("sse4.1"))) static void
+quantize_delta_zigzag_sse41(const double *xyz, size_t n, int dim, double e,
+                            int64_t *prev, uint64_t *out)
+{
+    if (dim != 2 && dim != 3) {
+        return quantize_delta_zigzag_scalar(xyz, n, dim, e, prev, out);
+    }
+    if (n == 0) {
+        return;
+    }
+    const size_t m = n * dim;
+    const __m128d scale = _mm_set1_pd(e);
+    __m128d bad = _mm_setzero_pd();
+    size_t k = 0;
+    if (dim == 3) {
+        for (; k + 2 <= m; k += 2) {
+            __m128d v = _mm_mul_pd(_mm_loadu_pd(xyz + k), scale);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + k),
+                             round_to_int64_sse41(v, bad));
+        }
+    } else {
+        for (; k + 2 <= m; k += 2) {
+            __m128d v = _mm_mul_pd(_mm_loadu_pd(xyz + k / 2 * 3), scale);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + k),
+                             round_to_int64_sse41(v, bad));
+        }
+    }
+    if (_mm_movemask_pd(bad)) {
+        return quantize_delta_zigzag_scalar(xyz, n, dim, e, prev, out);
+    }
+    for (; k < m; ++k) {
+        double x = xyz[k / dim * 3 + k % dim];
+        out[k] = static_cast<uint64_t>(static_cast<int64_t>(std::round(x * e)));
+    }
+
+    int64_t last[3];
+    save_last(out, m, dim, last);
+    k = m;
+    while (k >= static_cast<size_t>(dim) + 2) {
+        k -= 2;
+        __m128i cur =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(out + k));
+        __m128i before =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(out + k - dim));
+        __m128i d = _mm_sub_epi64(cur, before);
+        __m128i sign = _mm_shuffle_epi32(_mm_srai_epi32(d, 31),
+                                         _MM_SHUFFLE(3, 3, 1, 1));
+        __m128i zz = _mm_xor_si128(_mm_slli_epi64(d, 1), sign);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + k), zz);
+    }
+    delta_zigzag_tail(out, k, dim, prev);
+    std::copy(last, last + dim, prev);
+}
+#endif
+
+using QuantizeKernel = void (*)(const double *, size_t, int, double,
+                                int64_t *, uint64_t *);
+
+static QuantizeKernel resolve_quantize_kernel()
+{
+#ifdef GEOBUF_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return quantize_delta_zigzag_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return quantize_delta_zigzag_sse41;
+    }
+#endif
+    return quantize_delta_zigzag_scalar;
+}
+
+void quantize_delta_zigzag(const double *xyz, size_t n, int dim, double e,
+                           int64_t *prev, uint64_t *out)
+{
+    static const QuantizeKernel kernel = resolve_quantize_kernel();
+    kernel(xyz, n, dim, e, prev, out);
+}
+
+static const char *decode_delta_zigzag_scalar(const char *data,
+                                              const char *end, size_t n,
+                                              int dim, double e, int64_t *prev,
+                                              double *xyz)
+{
+    for (size_t i = 0; i < n && data != end; ++i, xyz += 3) {
+        for (int d = 0; d < dim; ++d) {
+            prev[d] += protozero::decode_zigzag64(
+                protozero::decode_varint(&data, end));
+            xyz[d] = prev[d] / e;
+        }
+    }
+    return data;
+}
+
+#ifdef GEOBUF_KERNELS_X86
+// Varints are decoded from 8-byte words: continuation bits give the varint
+// boundaries, BMI2 pext gathers the payload bits, so there is one load per
+// word instead of one branch per byte. Prefix sums are scalar, int64 ->
+// double and the division by e are done 4 lanes at a time. Division (not
+// multiplication by 1 / e) keeps it bit-exact with the scalar version.
+__attribute__((target("bmi,bmi2,avx2"))) static const char *
+decode_delta_zigzag_avx2(const char *data, const char *end, size_t n, int dim,
+                         double e, int64_t *prev, double *xyz)
+{
+    if (dim != 2 && dim != 3) {
+        return decode_delta_zigzag_scalar(data, end, n, dim, e, prev, xyz);
+    }
+    constexpr size_t BLOCK = 256;
+    constexpr uint64_t PAYLOAD = 0x7f7f7f7f7f7f7f7fULL;
+    constexpr uint64_t CONTINUATION = 0x8080808080808080ULL;
+    int64_t sums[BLOCK * 3 + 3]; // 4 values may be written at once
+    int64_t running[3] = {prev[0], prev[1], dim == 3 ? prev[2] : 0};
+    const __m256d scale = _mm256_set1_pd(e);
+    const __m256d magic = _mm256_set1_pd(MAGIC);
+    const __m256i limit = _mm256_set1_epi64x(static_cast<int64_t>(LIMIT));
+    const __m256i neg_limit = _mm256_set1_epi64x(-static_cast<int64_t>(LIMIT));
+    while (n > 0 && data != end) {
+        // 1. varint decode + zigzag of up to BLOCK points
+        const size_t want = std::min(n, BLOCK) * dim;
+        size_t k = 0;
+        while (k < want && data != end) {
+            uint64_t word;
+            if (end - data >= 8 &&
+                (std::memcpy(&word, data, 8), (~word & CONTINUATION) != 0)) {
+                // up to 4 varints ending in this word, branch free: stop
+                // bits (clear continuation bits) mark the last byte of each
+                const uint64_t s1 = ~word & CONTINUATION;
+                const uint64_t s2 = _blsr_u64(s1);
+                const uint64_t s3 = _blsr_u64(s2);
+                const uint64_t s4 = _blsr_u64(s3);
+                // bits up to and including each stop
+                const uint64_t m1 = _blsmsk_u64(s1);
+                const uint64_t m2 = _blsmsk_u64(s2);
+                const uint64_t m3 = _blsmsk_u64(s3);
+                const uint64_t m4 = _blsmsk_u64(s4);
+                sums[k] =
+                    protozero::decode_zigzag64(_pext_u64(word, m1 & PAYLOAD));
+                sums[k + 1] = protozero::decode_zigzag64(
+                    _pext_u64(word, m2 & ~m1 & PAYLOAD));
+                sums[k + 2] = protozero::decode_zigzag64(
+                    _pext_u64(word, m3 & ~m2 & PAYLOAD));
+                sums[k + 3] = protozero::decode_zigzag64(
+                    _pext_u64(word, m4 & ~m3 & PAYLOAD));
+                // s4 (or m4) is 0 (all ones) if there are fewer than 4 stops
+                const size_t count = std::min<size_t>(
+                    s4 ? 4 : s3 ? 3 : s2 ? 2 : 1, want - k);
+                const uint64_t last = count == 4   ? s4
+                                      : count == 3 ? s3
+                                      : count == 2 ? s2
+                                                   : s1;
+                data += (__builtin_ctzll(last) >> 3) + 1;
+                k += count;
+            } else {
+                // near the end, or longer than 8 bytes
+                sums[k++] = protozero::decode_zigzag64(
+                    protozero::decode_varint(&data, end));
+            }
+        }
+        if (k % dim != 0) {
+            throw protozero::end_of_buffer_exception{};
+        }
+        // prefix sums, per dimension
+        if (dim == 2) {
+            __m128i acc = _mm_loadu_si128(reinterpret_cast<__m128i *>(running));
+            for (size_t j = 0; j < k; j += 2) {
+                auto *p = reinterpret_cast<__m128i *>(sums + j);
+                acc = _mm_add_epi64(acc, _mm_loadu_si128(p));
+                _mm_storeu_si128(p, acc);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(running), acc);
+        } else {
+            int64_t x = running[0], y = running[1], z = running[2];
+            for (size_t j = 0; j < k; j += 3) {
+                sums[j] = x += sums[j];
+                sums[j + 1] = y += sums[j + 1];
+                sums[j + 2] = z += sums[j + 2];
+            }
+            running[0] = x;
+            running[1] = y;
+            running[2] = z;
+        }
+        // 2. sum / e, exact int64 -> double conversion needs |sum| <= 2^51
+        const size_t m = k;
+        __m256i bad = _mm256_setzero_si256();
+        size_t j = 0;
+        for (; j + 4 <= m; j += 4) {
+            __m256i v =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(sums + j));
+            bad = _mm256_or_si256(
+                bad, _mm256_or_si256(_mm256_cmpgt_epi64(v, limit),
+                                     _mm256_cmpgt_epi64(neg_limit, v)));
+            __m256d x = _mm256_sub_pd(
+                _mm256_castsi256_pd(
+                    _mm256_add_epi64(v, _mm256_castpd_si256(magic))),
+                magic);
+            __m256d r = _mm256_div_pd(x, scale);
+            if (dim == 3) {
+                _mm256_storeu_pd(xyz + j, r);
+            } else {
+                double *p = xyz + j / 2 * 3;
+                _mm_storeu_pd(p, _mm256_castpd256_pd128(r));
+                _mm_storeu_pd(p + 3, _mm256_extractf128_pd(r, 1));
+            }
+        }
+        if (!_mm256_testz_si256(bad, bad)) {
+            j = 0; // out of range, redo the block in scalar
+        }
+        for (; j < m; ++j) {
+            xyz[j / dim * 3 + j % dim] = sums[j] / e;
+        }
+        const size_t count = m / dim;
+        xyz += count * 3;
+        n -= count;
+    }
+    std::copy(running, running + dim, prev);
+    return data;
+}
+#endif
+
+using DecodeKernel = const char *(*)(const char *, const char *, size_t, int,
+                                     double, int64_t *, double *);
+
+static DecodeKernel resolve_decode_kernel()
+{
+#ifdef GEOBUF_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") &&
+        __builtin_cpu_supports("bmi2")) {
+        return decode_delta_zigzag_avx2;
+    }
+#endif
+    return decode_delta_zigzag_scalar;
+}
+
+const char *decode_delta_zigzag(const char *data, const char *end, size_t n,
+                                int dim, double e, int64_t *prev, double *xyz)
+{
+    static const DecodeKernel kernel = resolve_decode_kernel();
+    return kernel(data, end, n, dim, e, prev, xyz);
+}
+} // namespace kernels
+} // namespace geobuf
+} // namespace mapbox
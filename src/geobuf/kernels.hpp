@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mapbox
+{
+namespace geobuf
+{
+namespace kernels
+{
+// Coordinate kernels, runtime-dispatched to AVX2/SSE4.1 when the CPU has
+// them, bit-exact with the scalar fallback.
+
+// For `n` xyz points (stride 3 doubles), quantize the first `dim` coordinates
+// (std::round(x * e)), delta-encode them against the previous point and
+// zigzag the deltas, `out` should hold n * dim values.
+// `prev` is the quantized point before xyz[0] ({0, 0, 0} to start a line),
+// it's updated to the last point so a line can be processed block by block.
+void quantize_delta_zigzag(const double *xyz, size_t n, int dim, double e,
+                           int64_t *prev, uint64_t *out);
+
+// Inverse of the above, straight from a packed field: decode up to `n` points
+// of zigzag-ed varint deltas from [data, end), prefix-sum them onto `prev`
+// (updated) and write sum / e to the first `dim` of each xyz point (stride 3
+// doubles). Stops early at `end` (between points), returns where it stopped.
+// Throws protozero::end_of_buffer_exception on a truncated varint.
+const char *decode_delta_zigzag(const char *data, const char *end, size_t n,
+                                int dim, double e, int64_t *prev, double *xyz);
+} // namespace kernels
+} // namespace geobuf
+} // namespace mapbox
@@ -11,6 +11,7 @@
 #include <mapbox/geojson/rapidjson.hpp>
 
 #include <pybind11/iostream.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
@@ -382,6 +383,286 @@ inline geojson_value to_geojson_value(const py::handle &obj)
         "to_geojson_value not implemented for this type of object: " +
         py::repr(obj).cast<std::string>());
 }
+
+// Python (GeoJSON-like dicts, lists, numpy arrays for coordinates) straight
+// to mapbox::geojson, same result as mapbox::geojson::convert(to_rapidjson(
+// obj)) without the rapidjson tree. Anything off the common shapes goes
+// through that path (and its errors).
+namespace detail
+{
+// dict[key], None if missing
+inline py::object get_item(const py::dict &dict, const char *key)
+{
+    PyObject *item = PyDict_GetItemString(dict.ptr(), key);
+    return item ? py::reinterpret_borrow<py::object>(item) : py::none();
+}
+
+inline double to_double(const py::handle &obj)
+{
+    double x = PyFloat_AsDouble(obj.ptr());
+    if (x == -1.0 && PyErr_Occurred()) {
+        throw py::error_already_set();
+    }
+    return x;
+}
+
+// same numbers as to_rapidjson + convert: non-negative integers as uint64
+inline geojson_value to_value(const py::handle &obj)
+{
+    if (obj.is_none()) {
+        return nullptr;
+    } else if (py::isinstance<py::bool_>(obj)) {
+        return obj.cast<bool>();
+    } else if (py::isinstance<py::float_>(obj)) {
+        return to_double(obj);
+    } else if (py::isinstance<py::int_>(obj)) {
+        auto json = py_int_to_rapidjson(obj);
+        if (json.IsUint64()) {
+            return json.GetUint64();
+        }
+        return json.GetInt64();
+    } else if (py::isinstance<py::str>(obj)) {
+        return obj.cast<std::string>();
+    } else if (py::isinstance<py::list>(obj) ||
+               py::isinstance<py::tuple>(obj)) {
+        geojson_value::array_type ret;
+        ret.reserve(py::len(obj));
+        for (const py::handle &e : obj) {
+            ret.push_back(to_value(e));
+        }
+        return ret;
+    } else if (py::isinstance<py::dict>(obj)) {
+        geojson_value::object_type ret;
+        for (auto item : obj.cast<py::dict>()) {
+            ret.emplace(py::str(item.first).cast<std::string>(),
+                        to_value(item.second));
+        }
+        return ret;
+    }
+    return mapbox::geojson::convert<geojson_value>(to_rapidjson(obj));
+}
+
+inline void to_properties(const py::dict &dict,
+                          mapbox::feature::property_map &props,
+                          std::initializer_list<const char *> skipped = {})
+{
+    for (auto item : dict) {
+        auto key = py::str(item.first).cast<std::string>();
+        if (std::find_if(skipped.begin(), skipped.end(), [&](const char *k) {
+                return key == k;
+            }) != skipped.end()) {
+            continue;
+        }
+        props.emplace(std::move(key), to_value(item.second));
+    }
+}
+
+inline mapbox::geojson::point to_point(const py::handle &obj)
+{
+    if (py::isinstance<py::array>(obj)) {
+        auto arr = py::array_t<double, py::array::c_style |
+                                           py::array::forcecast>::ensure(obj);
+        if (arr && arr.ndim() == 1 && arr.size() >= 2) {
+            auto xyz = arr.data();
+            return {xyz[0], xyz[1], arr.size() > 2 ? xyz[2] : 0.0};
+        }
+    } else if (py::isinstance<py::list>(obj) ||
+               py::isinstance<py::tuple>(obj)) {
+        auto seq = py::reinterpret_borrow<py::sequence>(obj);
+        const auto size = seq.size();
+        if (size >= 2) {
+            return {to_double(seq[0]), to_double(seq[1]),
+                    size > 2 ? to_double(seq[2]) : 0.0};
+        }
+    }
+    return mapbox::geojson::convert<mapbox::geojson::point>(
+        to_rapidjson(obj));
+}
+
+// line string, multi point, linear ring: a list of points or a N*2, N*3 array
+template <typename Points> Points to_points(const py::handle &obj)
+{
+    Points points;
+    if (py::isinstance<py::array>(obj)) {
+        auto arr = py::array_t<double, py::array::c_style |
+                                           py::array::forcecast>::ensure(obj);
+        if (arr && arr.ndim() == 2 &&
+            (arr.shape(1) == 2 || arr.shape(1) == 3)) {
+            const auto cols = arr.shape(1);
+            points.resize(arr.shape(0));
+            for (size_t i = 0; i < points.size(); ++i) {
+                const double *xyz = arr.data(i, 0);
+                points[i] = {xyz[0], xyz[1], cols > 2 ? xyz[2] : 0.0};
+            }
+            return points;
+        }
+    }
+    points.reserve(py::len(obj));
+    for (const py::handle &p : obj) {
+        points.push_back(to_point(p));
+    }
+    return points;
+}
+
+// multi line string, polygon: a list of Points (or a 3d array)
+template <typename Lines> Lines to_lines(const py::handle &obj)
+{
+    Lines lines;
+    lines.reserve(py::len(obj));
+    for (const py::handle &line : obj) {
+        lines.push_back(to_points<typename Lines::value_type>(line));
+    }
+    return lines;
+}
+
+inline mapbox::geojson::geometry to_geometry(const py::handle &obj)
+{
+    using namespace mapbox::geojson;
+    if (obj.is_none()) {
+        return geometry{};
+    } else if (py::isinstance<geometry>(obj)) {
+        return obj.cast<const geometry &>();
+    } else if (!py::isinstance<py::dict>(obj)) {
+        return convert<geometry>(to_rapidjson(obj));
+    }
+    auto dict = obj.cast<py::dict>();
+    auto type = get_item(dict, "type");
+    if (!py::isinstance<py::str>(type)) {
+        return convert<geometry>(to_rapidjson(obj));
+    }
+    const auto name = type.cast<std::string>();
+    geometry g;
+    if (name == "GeometryCollection") {
+        auto geometries = get_item(dict, "geometries");
+        if (!py::isinstance<py::list>(geometries)) {
+            return convert<geometry>(to_rapidjson(obj));
+        }
+        geometry_collection collection;
+        collection.reserve(py::len(geometries));
+        for (const py::handle &child : geometries) {
+            collection.push_back(to_geometry(child));
+        }
+        g = std::move(collection);
+    } else {
+        auto coords = get_item(dict, "coordinates");
+        if (coords.is_none()) {
+            return convert<geometry>(to_rapidjson(obj));
+        }
+        if (name == "Point") {
+            g = to_point(coords);
+        } else if (name == "MultiPoint") {
+            g = to_points<multi_point>(coords);
+        } else if (name == "LineString") {
+            g = to_points<line_string>(coords);
+        } else if (name == "MultiLineString") {
+            g = to_lines<multi_line_string>(coords);
+        } else if (name == "Polygon") {
+            g = to_lines<polygon>(coords);
+        } else if (name == "MultiPolygon") {
+            multi_polygon polygons;
+            polygons.reserve(py::len(coords));
+            for (const py::handle &polygon_coords : coords) {
+                polygons.push_back(to_lines<polygon>(polygon_coords));
+            }
+            g = std::move(polygons);
+        } else {
+            return convert<geometry>(to_rapidjson(obj));
+        }
+    }
+    to_properties(dict, g.custom_properties,
+                  {"type", "coordinates", "geometries"});
+    return g;
+}
+
+inline mapbox::geojson::feature to_feature(const py::handle &obj)
+{
+    using namespace mapbox::geojson;
+    if (py::isinstance<feature>(obj)) {
+        return obj.cast<const feature &>();
+    } else if (!py::isinstance<py::dict>(obj)) {
+        return convert<feature>(to_rapidjson(obj));
+    }
+    auto dict = obj.cast<py::dict>();
+    feature f;
+    bool has_type = false, has_geometry = false;
+    for (auto item : dict) {
+        if (!py::isinstance<py::str>(item.first)) {
+            return convert<feature>(to_rapidjson(obj));
+        }
+        auto key = item.first.cast<std::string>();
+        auto value = item.second;
+        if (key == "type") {
+            if (!py::isinstance<py::str>(value) ||
+                value.cast<std::string>() != "Feature") {
+                return convert<feature>(to_rapidjson(obj));
+            }
+            has_type = true;
+        } else if (key == "geometry") {
+            f.geometry = to_geometry(value);
+            has_geometry = true;
+        } else if (key == "properties") {
+            if (py::isinstance<py::dict>(value)) {
+                to_properties(value.cast<py::dict>(), f.properties);
+            } else if (!value.is_none()) {
+                return convert<feature>(to_rapidjson(obj));
+            }
+        } else if (key == "id") {
+            if (py::isinstance<py::str>(value)) {
+                f.id = value.cast<std::string>();
+            } else if (py::isinstance<py::int_>(value) &&
+                       !py::isinstance<py::bool_>(value)) {
+                auto json = py_int_to_rapidjson(value);
+                if (json.IsUint64()) {
+                    f.id = json.GetUint64();
+                } else {
+                    f.id = json.GetInt64();
+                }
+            } else if (py::isinstance<py::float_>(value)) {
+                f.id = to_double(value);
+            } else {
+                return convert<feature>(to_rapidjson(obj));
+            }
+        } else {
+            f.custom_properties.emplace(std::move(key), to_value(value));
+        }
+    }
+    // whatever convert makes of them (or throws)
+    if (!has_type || !has_geometry) {
+        return convert<feature>(to_rapidjson(obj));
+    }
+    return f;
+}
+} // namespace detail
+
+inline mapbox::geojson::geojson to_geojson(const py::handle &obj)
+{
+    using namespace mapbox::geojson;
+    if (!py::isinstance<py::dict>(obj)) {
+        return convert(to_rapidjson(obj));
+    }
+    auto dict = obj.cast<py::dict>();
+    auto type = detail::get_item(dict, "type");
+    if (!py::isinstance<py::str>(type)) {
+        return convert(to_rapidjson(obj));
+    }
+    const auto name = type.cast<std::string>();
+    if (name == "Feature") {
+        return detail::to_feature(obj);
+    } else if (name != "FeatureCollection") {
+        return detail::to_geometry(obj);
+    }
+    auto features = detail::get_item(dict, "features");
+    if (!py::isinstance<py::list>(features)) {
+        return convert(to_rapidjson(obj));
+    }
+    feature_collection fc;
+    fc.reserve(py::len(features));
+    for (const py::handle &f : features) {
+        fc.push_back(detail::to_feature(f));
+    }
+    detail::to_properties(dict, fc.custom_properties, {"type", "features"});
+    return fc;
+}
 } // namespace cubao
 
 #ifndef BIND_PY_FLUENT_ATTRIBUTE
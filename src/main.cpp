@@ -12,13 +12,18 @@
 #include "geobuf/geobuf.hpp"
 #include "geobuf/pybind11_helpers.hpp"
 
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <string_view>
+#include <unordered_map>
 
 #define STRINGIFY(x) #x
 #define MACRO_STRINGIFY(x) STRINGIFY(x)
 
 namespace py = pybind11;
 using namespace pybind11::literals;
+using rvp = py::return_value_policy;
 
 namespace cubao
 {
@@ -26,6 +31,227 @@ void bind_geojson(py::module &m);
 void bind_rapidjson(py::module &m);
 } // namespace cubao
 
+// lazy iteration over features, decoded one at a time
+struct FeatureIterator
+{
+    std::shared_ptr<mapbox::geobuf::GeobufReader> reader;
+    size_t index = 0;
+};
+
+// encoded bytes handed over to Python as is, exposed through the buffer
+// protocol (py::bytes would be a copy)
+struct Bytes
+{
+    std::string data;
+};
+
+// contiguous bytes of any buffer-protocol object (bytes, memoryview, mmap,
+// numpy array...), not copied, valid as long as `info` is
+static protozero::data_view bytes_view(const py::buffer_info &info)
+{
+    auto stride = info.itemsize;
+    for (auto i = info.ndim - 1; i >= 0; --i) {
+        if (info.shape[i] > 1 && info.strides[i] != stride) {
+            throw std::invalid_argument("geobuf buffer is not contiguous");
+        }
+        stride *= info.shape[i];
+    }
+    return {static_cast<const char *>(info.ptr),
+            static_cast<size_t>(info.size * info.itemsize)};
+}
+
+// geobuf bytes passed from Python: any buffer-protocol object (viewed, see
+// bytes_view) or a str (its UTF-8 encoding, copied, as before buffers were
+// accepted)
+struct GeobufBytes
+{
+    explicit GeobufBytes(const py::object &geobuf)
+    {
+        if (py::isinstance<py::str>(geobuf)) {
+            str = geobuf.cast<std::string>();
+            from_str = true;
+        } else if (py::isinstance<py::buffer>(geobuf)) {
+            info = geobuf.cast<py::buffer>().request();
+        } else {
+            throw py::type_error("geobuf should be bytes-like or str");
+        }
+    }
+    protozero::data_view view() const
+    {
+        return from_str ? protozero::data_view{str} : bytes_view(info);
+    }
+
+  private:
+    py::buffer_info info;
+    std::string str;
+    bool from_str = false;
+};
+
+// Decoder.iter_features: decoded one at a time straight from the Python
+// buffer, which `input` keeps alive (no copy)
+struct FeatureStream
+{
+    std::unique_ptr<GeobufBytes> input;
+    std::unique_ptr<mapbox::geobuf::FeatureCursor> cursor;
+};
+
+// Plain Python objects (dict, list, str, int, float, bool, None) built with
+// the CPython API from the decoder's handler calls. Values go on a stack,
+// a list or dict is made once all of its items are there (lists with their
+// exact size). Keys are interned, created once per distinct key.
+struct PythonBuilder : mapbox::geobuf::JsonHandler
+{
+    bool Null() override { return push(py::none()); }
+    bool Bool(bool b) override { return push(py::bool_(b)); }
+    bool Int64(int64_t i) override { return push(py::int_(i)); }
+    bool Uint64(uint64_t u) override { return push(py::int_(u)); }
+    bool Double(double d) override { return push(py::float_(d)); }
+    bool String(const char *str, SizeType length, bool) override
+    {
+        return push(py::str(str, length));
+    }
+    bool StartObject() override
+    {
+        starts.push_back(stack.size());
+        return true;
+    }
+    bool Key(const char *str, SizeType length, bool) override
+    {
+        return push(key(std::string_view(str, length)));
+    }
+    bool EndObject(SizeType) override
+    {
+        const size_t begin = starts.back();
+        starts.pop_back();
+        py::dict dict;
+        for (size_t i = begin; i + 1 < stack.size(); i += 2) {
+            if (PyDict_SetItem(dict.ptr(), stack[i].ptr(),
+                               stack[i + 1].ptr()) != 0) {
+                throw py::error_already_set();
+            }
+        }
+        stack.resize(begin);
+        return push(std::move(dict));
+    }
+    bool StartArray() override
+    {
+        starts.push_back(stack.size());
+        return true;
+    }
+    bool EndArray(SizeType) override
+    {
+        const size_t begin = starts.back();
+        starts.pop_back();
+        py::list list(stack.size() - begin);
+        for (size_t i = begin; i < stack.size(); ++i) {
+            // steals the reference
+            PyList_SET_ITEM(list.ptr(), i - begin, stack[i].release().ptr());
+        }
+        stack.resize(begin);
+        return push(std::move(list));
+    }
+
+    py::object result() { return stack.empty() ? py::none() : stack.back(); }
+
+  private:
+    bool push(py::object &&value)
+    {
+        stack.push_back(std::move(value));
+        return true;
+    }
+    py::object key(std::string_view str)
+    {
+        auto it = keys.find(str);
+        if (it != keys.end()) {
+            return it->second;
+        }
+        PyObject *ptr = PyUnicode_FromStringAndSize(str.data(), str.size());
+        if (!ptr) {
+            throw py::error_already_set();
+        }
+        PyUnicode_InternInPlace(&ptr);
+        auto key = py::reinterpret_steal<py::object>(ptr);
+        // viewed in the key's own (immutable) UTF-8 buffer
+        Py_ssize_t size = 0;
+        const char *data = PyUnicode_AsUTF8AndSize(ptr, &size);
+        if (!data) {
+            throw py::error_already_set();
+        }
+        keys.emplace(std::string_view(data, size), key);
+        return key;
+    }
+
+    std::vector<py::object> stack;
+    std::vector<size_t> starts; // of the lists and dicts being built
+    std::unordered_map<std::string_view, py::object> keys;
+};
+
+// any of GeoJSON, FeatureCollection, Feature, Geometry, GeoJSON text or a
+// GeoJSON-like dict, as mapbox::geojson::geojson (needs the GIL)
+static mapbox::geojson::geojson as_geojson(const py::handle &obj)
+{
+    using namespace mapbox::geojson;
+    if (py::isinstance<geojson>(obj)) {
+        return obj.cast<const geojson &>();
+    } else if (py::isinstance<feature_collection>(obj)) {
+        return geojson{obj.cast<const feature_collection &>()};
+    } else if (py::isinstance<feature>(obj)) {
+        return geojson{obj.cast<const feature &>()};
+    } else if (py::isinstance<geometry>(obj)) {
+        return geojson{obj.cast<const geometry &>()};
+    } else if (py::isinstance<py::str>(obj)) {
+        return convert(mapbox::geobuf::parse(obj.cast<std::string>()));
+    }
+    return cubao::to_geojson(obj);
+}
+
+// fn (pure C++, no Python objects touched) runs with the GIL released
+template <typename Fn> static auto without_gil(Fn &&fn)
+{
+    py::gil_scoped_release release;
+    return fn();
+}
+
+// same, with self's mutex held: an Encoder/Decoder may be shared between
+// Python threads
+template <typename T, typename Fn>
+static auto without_gil(const T &self, Fn &&fn)
+{
+    py::gil_scoped_release release;
+    std::lock_guard<std::mutex> lock(self.mutex);
+    return fn();
+}
+
+// self's mutex for calls keeping the GIL, waited for without it (its holder
+// may need the GIL to finish)
+template <typename T>
+static std::unique_lock<std::mutex> lock_instance(const T &self)
+{
+    std::unique_lock<std::mutex> lock(self.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        py::gil_scoped_release release;
+        lock.lock();
+    }
+    return lock;
+}
+
+static py::object to_bytes(std::string &&bytes, bool copy)
+{
+    if (copy) {
+        return py::bytes(bytes);
+    }
+    return py::cast(Bytes{std::move(bytes)});
+}
+
+// input owned by Python (a bound geojson or json object) is copied with the
+// GIL held, other threads may modify it, then encoded without the GIL
+static py::object encode_copy(mapbox::geobuf::Encoder &self,
+                              mapbox::geojson::geojson input, bool copy)
+{
+    return to_bytes(without_gil(self, [&] { return self.encode(input); }),
+                    copy);
+}
+
 PYBIND11_MODULE(_pybind11_geobuf, m)
 {
     using namespace mapbox::geobuf;
@@ -33,7 +259,14 @@ PYBIND11_MODULE(_pybind11_geobuf, m)
     m.def(
         "normalize_json",
         [](const std::string &input, const std::string &output, bool indent,
-           bool sort_keys) {
+           bool sort_keys, bool insitu) {
+            if (insitu) {
+                auto json = mapbox::geobuf::load_json_insitu(input);
+                if (sort_keys) {
+                    mapbox::geobuf::sort_keys_inplace(*json);
+                }
+                return mapbox::geobuf::dump_json(output, *json, indent);
+            }
             auto json = mapbox::geobuf::load_json(input);
             if (sort_keys) {
                 mapbox::geobuf::sort_keys_inplace(json);
@@ -41,7 +274,8 @@ PYBIND11_MODULE(_pybind11_geobuf, m)
             return mapbox::geobuf::dump_json(output, json, indent);
         },
         "input_path"_a, "output_path"_a, //
-        py::kw_only(), "indent"_a = true, "sort_keys"_a = true);
+        py::kw_only(), "indent"_a = true, "sort_keys"_a = true,
+        "insitu"_a = false, py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "str2json2str",
@@ -60,7 +294,7 @@ PYBIND11_MODULE(_pybind11_geobuf, m)
         "json_string"_a,    //
         py::kw_only(),      //
         "indent"_a = false, //
-        "sort_keys"_a = false);
+        "sort_keys"_a = false, py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "str2geojson2str",
@@ -81,96 +315,213 @@ PYBIND11_MODULE(_pybind11_geobuf, m)
         "json_string"_a,    //
         py::kw_only(),      //
         "indent"_a = false, //
-        "sort_keys"_a = false);
+        "sort_keys"_a = false, py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "pbf_decode",
-        [](const std::string &pbf_bytes, const std::string &indent)
-            -> std::string { return Decoder::to_printable(pbf_bytes, indent); },
+        [](const py::object &pbf_bytes, const std::string &indent) {
+            GeobufBytes input{pbf_bytes};
+            return without_gil([&] {
+                return Decoder::to_printable(input.view(), indent);
+            });
+        },
         "pbf_bytes"_a, //
         py::kw_only(), //
         "indent"_a = "");
 
     py::class_<Encoder>(m, "Encoder", py::module_local()) //
-        .def(py::init<uint32_t>(),                        //
+        .def(py::init<uint32_t, int>(),                   //
              py::kw_only(),
-             "max_precision"_a = std::pow(10, MAPBOX_GEOBUF_DEFAULT_PRECISION))
+             "max_precision"_a = std::pow(10, MAPBOX_GEOBUF_DEFAULT_PRECISION),
+             "threads"_a = 1)
         //
         .def(
             "encode",
-            [](Encoder &self, const mapbox::geojson::geojson &geojson) {
-                return py::bytes(self.encode(geojson));
+            [](Encoder &self, const mapbox::geojson::geojson &geojson,
+               bool copy) {
+                return encode_copy(self, geojson, copy);
             },
-            "geojson"_a)
+            "geojson"_a, py::kw_only(), "copy"_a = true)
         .def(
             "encode",
             [](Encoder &self,
-               const mapbox::geojson::feature_collection &geojson) {
-                return py::bytes(self.encode(geojson));
+               const mapbox::geojson::feature_collection &geojson,
+               bool copy) {
+                return encode_copy(self, mapbox::geojson::geojson{geojson},
+                                   copy);
             },
-            "features"_a)
+            "features"_a, py::kw_only(), "copy"_a = true)
         .def(
             "encode",
-            [](Encoder &self, const mapbox::geojson::feature &geojson) {
-                return py::bytes(self.encode(geojson));
+            [](Encoder &self, const mapbox::geojson::feature &geojson,
+               bool copy) {
+                return encode_copy(self, mapbox::geojson::geojson{geojson},
+                                   copy);
             },
-            "feature"_a)
+            "feature"_a, py::kw_only(), "copy"_a = true)
         .def(
             "encode",
-            [](Encoder &self, const mapbox::geojson::geometry &geojson) {
-                return py::bytes(self.encode(geojson));
+            [](Encoder &self, const mapbox::geojson::geometry &geojson,
+               bool copy) {
+                return encode_copy(self, mapbox::geojson::geojson{geojson},
+                                   copy);
             },
-            "geometry"_a)
+            "geometry"_a, py::kw_only(), "copy"_a = true)
         .def(
             "encode",
-            [](Encoder &self, const RapidjsonValue &geojson) {
-                return py::bytes(self.encode(geojson));
+            [](Encoder &self, const RapidjsonValue &geojson, bool copy) {
+                return encode_copy(self, mapbox::geojson::convert(geojson),
+                                   copy);
             },
-            "geojson"_a)
+            "geojson"_a, py::kw_only(), "copy"_a = true)
         .def(
             "encode",
-            [](Encoder &self, const py::object &geojson) {
+            [](Encoder &self, const py::object &geojson, bool copy) {
                 if (py::isinstance<py::str>(geojson)) {
                     auto str = geojson.cast<std::string>();
-                    return py::bytes(self.encode(str));
+                    return to_bytes(
+                        without_gil(self, [&] { return self.encode(str); }),
+                        copy);
+                }
+                // dicts/lists walked directly, no rapidjson tree in between
+                auto input = cubao::to_geojson(geojson);
+                return to_bytes(
+                    without_gil(self, [&] { return self.encode(input); }),
+                    copy);
+            },
+            "geojson"_a, py::kw_only(), "copy"_a = true)
+        .def(
+            "encode",
+            [](Encoder &self, const std::string &geojson,
+               const std::string &geobuf) {
+                return without_gil(
+                    self, [&] { return self.encode(geojson, geobuf); });
+            },
+            py::kw_only(), "geojson"_a, "geobuf"_a)
+        .def(
+            "encode_many",
+            [](Encoder &self, const py::sequence &geojsons, bool copy) {
+                std::vector<mapbox::geojson::geojson> inputs;
+                inputs.reserve(geojsons.size());
+                for (auto geojson : geojsons) {
+                    inputs.push_back(as_geojson(geojson));
+                }
+                auto encoded = without_gil(
+                    self, [&] { return self.encode_many(inputs); });
+                py::list outputs(encoded.size());
+                for (size_t i = 0; i < encoded.size(); ++i) {
+                    outputs[i] = to_bytes(std::move(encoded[i]), copy);
                 }
-                return py::bytes(self.encode(cubao::to_rapidjson(geojson)));
+                return outputs;
             },
-            "geojson"_a)
-        .def("encode",
-             py::overload_cast<const std::string &, const std::string &>(
-                 &Encoder::encode),
-             py::kw_only(), "geojson"_a, "geobuf"_a)
+            "geojsons"_a, py::kw_only(), "copy"_a = true)
         //
         ;
 
     py::class_<Decoder>(m, "Decoder", py::module_local()) //
-        .def(py::init<>())
+        .def(py::init<int>(), py::kw_only(), "threads"_a = 1)
         //
-        .def("precision", &Decoder::precision)
+        .def("precision",
+             [](const Decoder &self) {
+                 auto lock = lock_instance(self);
+                 return self.precision();
+             })
+        .def(
+            "set_projection",
+            [](Decoder &self,
+               const std::optional<std::vector<std::string>> &properties,
+               bool geometry) {
+                auto lock = lock_instance(self);
+                self.set_projection(properties, geometry);
+            },
+            "properties"_a = py::none(), py::kw_only(), "geometry"_a = true)
         .def(
             "decode",
-            [](Decoder &self, const std::string &geobuf, bool indent,
+            [](Decoder &self, const py::object &geobuf, bool indent,
                bool sort_keys) {
-                return mapbox::geobuf::dump(self.decode(geobuf), indent,
-                                            sort_keys);
+                GeobufBytes input{geobuf};
+                return without_gil(self, [&] {
+                    return mapbox::geobuf::dump(self.decode(input.view()),
+                                                indent, sort_keys);
+                });
             },
             "geobuf"_a, py::kw_only(), "indent"_a = false,
             "sort_keys"_a = false)
         .def(
             "decode_to_rapidjson",
-            [](Decoder &self, const std::string &geobuf, bool sort_keys) {
-                auto json = geojson2json(self.decode(geobuf));
-                if (sort_keys) {
-                    sort_keys_inplace(json);
-                }
-                return json;
+            [](Decoder &self, const py::object &geobuf, bool sort_keys) {
+                GeobufBytes input{geobuf};
+                return without_gil(self, [&] {
+                    auto json = geojson2json(self.decode(input.view()));
+                    if (sort_keys) {
+                        sort_keys_inplace(json);
+                    }
+                    return json;
+                });
             },
             "geobuf"_a, py::kw_only(), "sort_keys"_a = false)
         .def(
             "decode_to_geojson",
-            [](Decoder &self, const std::string &geobuf) {
-                return self.decode(geobuf);
+            [](Decoder &self, const py::object &geobuf) {
+                GeobufBytes input{geobuf};
+                return without_gil(
+                    self, [&] { return self.decode(input.view()); });
+            },
+            "geobuf"_a)
+        .def(
+            "decode_to_geojson",
+            [](Decoder &self, const py::object &geobuf,
+               const std::array<double, 4> &bbox) {
+                GeobufBytes input{geobuf};
+                return without_gil(self, [&] {
+                    return mapbox::geojson::geojson{
+                        self.decode(input.view(), bbox)};
+                });
+            },
+            "geobuf"_a, py::kw_only(), "bbox"_a)
+        .def(
+            "decode_file",
+            [](Decoder &self, const std::string &path) {
+                return without_gil(self,
+                                   [&] { return self.decode_file(path); });
+            },
+            "path"_a)
+        .def(
+            "decode_to_python",
+            [](Decoder &self, const py::object &geobuf) {
+                GeobufBytes input{geobuf};
+                PythonBuilder builder;
+                auto lock = lock_instance(self);
+                self.decode_to_handler(input.view(), builder);
+                return builder.result();
+            },
+            "geobuf"_a)
+        .def(
+            "decode_many",
+            [](Decoder &self, const py::sequence &geobufs) {
+                std::vector<GeobufBytes> bytes;
+                std::vector<protozero::data_view> inputs;
+                bytes.reserve(geobufs.size());
+                inputs.reserve(geobufs.size());
+                for (const auto &geobuf : geobufs) {
+                    bytes.emplace_back(
+                        py::reinterpret_borrow<py::object>(geobuf));
+                    inputs.push_back(bytes.back().view());
+                }
+                return without_gil(
+                    self, [&] { return self.decode_many(inputs); });
+            },
+            "geobufs"_a)
+        .def(
+            "iter_features",
+            [](Decoder &self, const py::object &geobuf) {
+                auto stream = std::make_unique<FeatureStream>();
+                stream->input = std::make_unique<GeobufBytes>(geobuf);
+                // with the projection as of now
+                auto lock = lock_instance(self);
+                stream->cursor = std::make_unique<FeatureCursor>(
+                    self, stream->input->view());
+                return stream;
             },
             "geobuf"_a)
         .def(
@@ -180,7 +531,9 @@ PYBIND11_MODULE(_pybind11_geobuf, m)
                const std::string &geojson, //
                bool indent,                //
                bool sort_keys) {
-                return self.decode(geobuf, geojson, indent, sort_keys);
+                return without_gil(self, [&] {
+                    return self.decode(geobuf, geojson, indent, sort_keys);
+                });
             },
             py::kw_only(),      //
             "geobuf"_a,         //
@@ -190,6 +543,79 @@ PYBIND11_MODULE(_pybind11_geobuf, m)
         //
         ;
 
+    py::class_<GeobufReader, std::shared_ptr<GeobufReader>>(
+        m, "GeobufReader", py::module_local()) //
+        .def(py::init([](const py::object &geobuf) {
+                 GeobufBytes input{geobuf};
+                 auto bytes = input.view();
+                 return std::make_shared<GeobufReader>(
+                     std::string{bytes.data(), bytes.size()});
+             }),
+             "geobuf"_a)
+        //
+        .def("size", &GeobufReader::size)
+        .def("__len__", &GeobufReader::size)
+        .def("feature", &GeobufReader::feature, "index"_a)
+        .def("geometry", &GeobufReader::geometry, "index"_a)
+        .def("properties", &GeobufReader::properties, "index"_a)
+        .def("custom_properties", &GeobufReader::custom_properties,
+             rvp::reference_internal)
+        .def("keys", &GeobufReader::keys, rvp::reference_internal)
+        .def("dim", &GeobufReader::dim)
+        .def("precision", &GeobufReader::precision)
+        .def("__iter__",
+             [](std::shared_ptr<GeobufReader> self) {
+                 return FeatureIterator{std::move(self)};
+             })
+        //
+        ;
+
+    py::class_<FeatureIterator>(m, "FeatureIterator", py::module_local()) //
+        .def("__iter__",
+             [](FeatureIterator &self) -> FeatureIterator & { return self; },
+             rvp::reference_internal)
+        .def("__next__", [](FeatureIterator &self) {
+            if (self.index >= self.reader->size()) {
+                throw py::stop_iteration();
+            }
+            return self.reader->feature(self.index++);
+        })
+        //
+        ;
+
+    py::class_<FeatureStream>(m, "FeatureStream", py::module_local()) //
+        .def("__iter__",
+             [](FeatureStream &self) -> FeatureStream & { return self; },
+             rvp::reference_internal)
+        .def("__next__", [](FeatureStream &self) {
+            auto *feature = self.cursor->next();
+            if (!feature) {
+                throw py::stop_iteration();
+            }
+            return *feature;
+        })
+        //
+        ;
+
+    py::class_<Bytes>(m, "Bytes", py::buffer_protocol(), py::module_local())
+        .def_buffer([](Bytes &self) {
+            return py::buffer_info(
+                reinterpret_cast<const uint8_t *>(self.data.data()),
+                static_cast<py::ssize_t>(self.data.size()));
+        })
+        .def("__len__", [](const Bytes &self) { return self.data.size(); })
+        .def("__bytes__",
+             [](const Bytes &self) { return py::bytes(self.data); })
+        .def(
+            "__eq__",
+            [](const Bytes &self, const py::buffer &other) {
+                auto info = other.request();
+                return bytes_view(info) == protozero::data_view{self.data};
+            },
+            py::is_operator())
+        //
+        ;
+
     auto geojson = m.def_submodule("geojson");
     cubao::bind_geojson(geojson);
 
@@ -10,6 +10,7 @@
 #include "geobuf/pybind11_helpers.hpp"
 #include "geobuf/rapidjson_helpers.hpp"
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -21,6 +22,276 @@ using rvp = py::return_value_policy;
 
 using PropertyMap = mapbox::geojson::value::object_type;
 
+// Pickled geometries are (version, type, xyz, lengths, geometries,
+// custom_properties): x, y, z of the points as little-endian doubles (xyz,
+// bytes), sizes of lines/rings as little-endian uint64 (lengths, bytes), the
+// states of the children of a GeometryCollection (list, else None) and
+// custom properties (dict, or None). Exact, and much smaller and faster than
+// GeoJSON-like dicts. Bump PICKLE_VERSION on any change to this layout.
+constexpr int PICKLE_VERSION = 1;
+
+static void put_uint64(std::string &out, uint64_t u)
+{
+    char bytes[8];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<char>(u >> (8 * i));
+    }
+    out.append(bytes, 8);
+}
+static void put_double(std::string &out, double d)
+{
+    uint64_t u;
+    std::memcpy(&u, &d, sizeof(u));
+    put_uint64(out, u);
+}
+static uint64_t get_uint64(const char *bytes)
+{
+    uint64_t u = 0;
+    for (int i = 0; i < 8; ++i) {
+        u |= uint64_t(static_cast<uint8_t>(bytes[i])) << (8 * i);
+    }
+    return u;
+}
+static double get_double(const char *bytes)
+{
+    const uint64_t u = get_uint64(bytes);
+    double d;
+    std::memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+static void pack(const mapbox::geojson::point &point, std::string &xyz,
+                 std::string &)
+{
+    put_double(xyz, point.x);
+    put_double(xyz, point.y);
+    put_double(xyz, point.z);
+}
+static void pack(const std::vector<mapbox::geojson::point> &points,
+                 std::string &xyz, std::string &lengths)
+{
+    xyz.reserve(xyz.size() + points.size() * 24);
+    for (auto &point : points) {
+        pack(point, xyz, lengths);
+    }
+}
+template <typename Lines>
+static void pack_lines(const Lines &lines, std::string &xyz,
+                       std::string &lengths)
+{
+    for (auto &line : lines) {
+        put_uint64(lengths, line.size());
+        pack(line, xyz, lengths);
+    }
+}
+static void pack(const mapbox::geojson::multi_line_string &lines,
+                 std::string &xyz, std::string &lengths)
+{
+    pack_lines(lines, xyz, lengths);
+}
+static void pack(const mapbox::geojson::polygon &rings, std::string &xyz,
+                 std::string &lengths)
+{
+    pack_lines(rings, xyz, lengths);
+}
+// #polygons, then #rings ring1_size ring2_size ... of each of them
+static void pack(const mapbox::geojson::multi_polygon &polygons,
+                 std::string &xyz, std::string &lengths)
+{
+    put_uint64(lengths, polygons.size());
+    for (auto &polygon : polygons) {
+        put_uint64(lengths, polygon.size());
+        pack_lines(polygon, xyz, lengths);
+    }
+}
+
+static py::tuple to_state(const std::string &type, const std::string &xyz,
+                          const std::string &lengths,
+                          py::object geometries = py::none(),
+                          py::object custom_properties = py::none())
+{
+    return py::make_tuple(PICKLE_VERSION, type, py::bytes(xyz),
+                          py::bytes(lengths), geometries, custom_properties);
+}
+
+template <typename T> static py::tuple pickle_state(const T &g)
+{
+    static const auto type = geometry_type(mapbox::geojson::geometry{T{}});
+    std::string xyz, lengths;
+    pack(g, xyz, lengths);
+    return to_state(type, xyz, lengths);
+}
+
+static py::tuple pickle_state(const mapbox::geojson::geometry &g)
+{
+    std::string xyz, lengths;
+    py::object geometries = py::none();
+    g.match(
+        [&](const mapbox::geojson::geometry_collection &collection) {
+            py::list states;
+            for (auto &child : collection) {
+                states.append(pickle_state(child));
+            }
+            geometries = states;
+        },
+        [&](const mapbox::geojson::empty &) {},
+        [&](const auto &geom) { pack(geom, xyz, lengths); });
+    py::object custom_properties = py::none();
+    if (!g.custom_properties.empty()) {
+        py::dict props;
+        for (auto &p : g.custom_properties) {
+            props[py::str(p.first)] = to_python(p.second);
+        }
+        custom_properties = props;
+    }
+    return to_state(geometry_type(g), xyz, lengths, geometries,
+                    custom_properties);
+}
+
+// reads back what pack wrote, throws on truncated data
+struct Unpacker
+{
+    explicit Unpacker(const py::tuple &state)
+    {
+        view(state[2], xyz, xyz_end);
+        view(state[3], lengths, lengths_end);
+    }
+
+    void unpack(mapbox::geojson::point &point) { read(&point, 1); }
+    void unpack(std::vector<mapbox::geojson::point> &points)
+    {
+        points.resize(remaining());
+        read(points.data(), points.size());
+    }
+    // n lines, each of them takes a length
+    template <typename Lines> void unpack_lines(Lines &lines, size_t n)
+    {
+        if (n > lengths_left()) {
+            throw std::runtime_error("invalid pickled geometry (lengths)");
+        }
+        lines.resize(n);
+        for (auto &line : lines) {
+            const auto size = length();
+            if (size > remaining()) {
+                throw std::runtime_error("invalid pickled geometry (xyz)");
+            }
+            line.resize(size);
+            read(line.data(), size);
+        }
+    }
+    void unpack(mapbox::geojson::multi_line_string &lines)
+    {
+        unpack_lines(lines, lengths_left());
+    }
+    void unpack(mapbox::geojson::polygon &rings)
+    {
+        unpack_lines(rings, lengths_left());
+    }
+    void unpack(mapbox::geojson::multi_polygon &polygons)
+    {
+        const auto n = length();
+        if (n > lengths_left()) {
+            throw std::runtime_error("invalid pickled geometry (lengths)");
+        }
+        polygons.resize(n);
+        for (auto &polygon : polygons) {
+            unpack_lines(polygon, length());
+        }
+    }
+
+  private:
+    static void view(const py::handle &bytes, const char *&begin,
+                     const char *&end)
+    {
+        char *data = nullptr;
+        Py_ssize_t size = 0;
+        if (PyBytes_AsStringAndSize(bytes.ptr(), &data, &size) != 0) {
+            throw py::error_already_set();
+        }
+        begin = data;
+        end = data + size;
+    }
+    // #points left
+    size_t remaining() const { return (xyz_end - xyz) / 24; }
+    void read(mapbox::geojson::point *out, size_t n)
+    {
+        if (n > remaining()) {
+            throw std::runtime_error("invalid pickled geometry (xyz)");
+        }
+        for (size_t i = 0; i < n; ++i, xyz += 24) {
+            out[i].x = get_double(xyz);
+            out[i].y = get_double(xyz + 8);
+            out[i].z = get_double(xyz + 16);
+        }
+    }
+    size_t lengths_left() const { return (lengths_end - lengths) / 8; }
+    uint64_t length()
+    {
+        if (!lengths_left()) {
+            throw std::runtime_error("invalid pickled geometry (lengths)");
+        }
+        const auto n = get_uint64(lengths);
+        lengths += 8;
+        return n;
+    }
+
+    const char *xyz, *xyz_end, *lengths, *lengths_end;
+};
+
+static mapbox::geojson::geometry unpickle_geometry(const py::tuple &state)
+{
+    using namespace mapbox::geojson;
+    if (state.size() != 6 || !py::isinstance<py::int_>(state[0]) ||
+        state[0].cast<int>() != PICKLE_VERSION) {
+        throw std::runtime_error(
+            "unsupported pickled geometry (expected format version " +
+            std::to_string(PICKLE_VERSION) + ")");
+    }
+    const auto type = state[1].cast<std::string>();
+    auto unpack = [&](auto g) -> geometry {
+        Unpacker(state).unpack(g);
+        return g;
+    };
+    geometry g;
+    if (type == "Point") {
+        g = unpack(point{});
+    } else if (type == "MultiPoint") {
+        g = unpack(multi_point{});
+    } else if (type == "LineString") {
+        g = unpack(line_string{});
+    } else if (type == "MultiLineString") {
+        g = unpack(multi_line_string{});
+    } else if (type == "Polygon") {
+        g = unpack(polygon{});
+    } else if (type == "MultiPolygon") {
+        g = unpack(multi_polygon{});
+    } else if (type == "GeometryCollection") {
+        geometry_collection collection;
+        for (const py::handle &child : state[4]) {
+            collection.push_back(unpickle_geometry(child.cast<py::tuple>()));
+        }
+        g = std::move(collection);
+    }
+    if (!state[5].is_none()) {
+        detail::to_properties(state[5].cast<py::dict>(), g.custom_properties);
+    }
+    return g;
+}
+
+// also reads states pickled as GeoJSON-like dicts (older versions)
+template <typename T> static T unpickle(const py::object &state)
+{
+    auto g = py::isinstance<py::dict>(state)
+                 ? mapbox::geojson::convert<mapbox::geojson::geometry>(
+                       to_rapidjson(state))
+                 : unpickle_geometry(state.cast<py::tuple>());
+    if constexpr (std::is_same_v<T, mapbox::geojson::geometry>) {
+        return g;
+    } else {
+        return std::move(g.get<T>());
+    }
+}
+
 void bind_geojson(py::module &geojson)
 {
 #define is_geojson_type(geojson_type)                                          \
@@ -222,12 +493,10 @@ void bind_geojson(py::module &geojson)
         copy_deepcopy_clone(mapbox::geojson::geometry)
         .def(py::pickle(
             [](const mapbox::geojson::geometry &self) {
-                return to_python(self);
+                return pickle_state(self);
             },
-            [](py::object o) -> mapbox::geojson::geometry {
-                auto json = to_rapidjson(o);
-                return mapbox::geojson::convert<mapbox::geojson::geometry>(
-                    json);
+            [](py::object o) {
+                return unpickle<mapbox::geojson::geometry>(o);
             }))
         .def_property_readonly(
             "__geo_interface__",
@@ -305,12 +574,10 @@ void bind_geojson(py::module &geojson)
             "index"_a, "value"_a) copy_deepcopy_clone(mapbox::geojson::point)
         .def(py::pickle(
             [](const mapbox::geojson::point &self) {
-                return to_python(mapbox::geojson::geometry(self));
+                return pickle_state(self);
             },
-            [](py::object o) -> mapbox::geojson::point {
-                auto json = to_rapidjson(o);
-                return mapbox::geojson::convert<mapbox::geojson::geometry>(json)
-                    .get<mapbox::geojson::point>();
+            [](py::object o) {
+                return unpickle<mapbox::geojson::point>(o);
             }))
         .def_property_readonly(
             "__geo_interface__",
@@ -424,13 +691,10 @@ void bind_geojson(py::module &geojson)
             copy_deepcopy_clone(mapbox::geojson::geom_type)                    \
         .def(py::pickle(                                                       \
             [](const mapbox::geojson::geom_type &self) {                       \
-                return to_python(mapbox::geojson::geometry{self});             \
+                return pickle_state(self);                                     \
             },                                                                 \
-            [](py::object o) -> mapbox::geojson::geom_type {                   \
-                auto json = to_rapidjson(o);                                   \
-                return mapbox::geojson::convert<mapbox::geojson::geometry>(    \
-                           json)                                               \
-                    .get<mapbox::geojson::geom_type>();                        \
+            [](py::object o) {                                                 \
+                return unpickle<mapbox::geojson::geom_type>(o);                \
             }))                                                                \
         .def_property_readonly(                                                \
             "__geo_interface__",                                               \
@@ -515,13 +779,10 @@ void bind_geojson(py::module &geojson)
             copy_deepcopy_clone(mapbox::geojson::geom_type)                    \
         .def(py::pickle(                                                       \
             [](const mapbox::geojson::geom_type &self) {                       \
-                return to_python(mapbox::geojson::geometry{self});             \
+                return pickle_state(self);                                     \
             },                                                                 \
-            [](py::object o) -> mapbox::geojson::geom_type {                   \
-                auto json = to_rapidjson(o);                                   \
-                return mapbox::geojson::convert<mapbox::geojson::geometry>(    \
-                           json)                                               \
-                    .get<mapbox::geojson::geom_type>();                        \
+            [](py::object o) {                                                 \
+                return unpickle<mapbox::geojson::geom_type>(o);                \
             }))                                                                \
         .def_property_readonly(                                                \
             "__geo_interface__",                                               \
@@ -643,12 +904,10 @@ void bind_geojson(py::module &geojson)
             copy_deepcopy_clone(mapbox::geojson::multi_polygon)
         .def(py::pickle(
             [](const mapbox::geojson::multi_polygon &self) {
-                return to_python(mapbox::geojson::geometry{self});
+                return pickle_state(self);
             },
-            [](py::object o) -> mapbox::geojson::multi_polygon {
-                auto json = to_rapidjson(o);
-                return mapbox::geojson::convert<mapbox::geojson::geometry>(json)
-                    .get<mapbox::geojson::multi_polygon>();
+            [](py::object o) {
+                return unpickle<mapbox::geojson::multi_polygon>(o);
             }))
         .def_property_readonly(
             "__geo_interface__",
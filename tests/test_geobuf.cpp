@@ -1,4 +1,5 @@
 #include "geobuf/geobuf.hpp"
+#include "geobuf/kernels.hpp"
 #include "geobuf/version.h"
 
 #define DBG_MACRO_NO_WARNING
@@ -8,6 +9,23 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// counts heap allocations of this test binary
+static std::atomic<size_t> num_allocations{0};
+void *operator new(std::size_t size)
+{
+    ++num_allocations;
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
 std::string FIXTURES_DIR = PROJECT_SOURCE_DIR "/geobuf/test/fixtures";
 std::vector<std::string> FIXTURES = {
     "issue55.json",          //
@@ -136,3 +154,537 @@ TEST_CASE("roundtrip")
         roundtripTest(basename);
     }
 }
+
+TEST_CASE("streaming encode")
+{
+    auto inputs = std::vector<std::string>{
+        std::string(PROJECT_SOURCE_DIR "/data/sample1.json")};
+    for (auto &basename : FIXTURES) {
+        inputs.push_back(FIXTURES_DIR + std::string("/") + basename);
+    }
+    for (auto &input : inputs) {
+        auto output = dbg(std::string{PROJECT_BINARY_DIR "/streaming.pbf"});
+        auto encoder = mapbox::geobuf::Encoder();
+        CHECK(encoder.encode(input, output));
+        auto expected = encoder.encode(
+            mapbox::geojson::convert(mapbox::geobuf::load_json(input)));
+        // key table is in document order (encode walks unordered property
+        // maps): the bytes may differ, the decoded GeoJSON may not
+        auto decoder = mapbox::geobuf::Decoder();
+        CHECK(decoder.decode(mapbox::geobuf::load_bytes(output)) ==
+              decoder.decode(expected));
+    }
+}
+
+mapbox::geojson::feature_collection sample_features(int n)
+{
+    mapbox::geojson::feature_collection fc;
+    fc.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        mapbox::geojson::feature f;
+        auto line = mapbox::geojson::line_string{};
+        for (int j = 0; j < 10; ++j) {
+            line.emplace_back(120.0 + i * 1e-4 + j * 1e-5, 30.0 + j * 1e-3,
+                              j % 2 ? 0.0 : 1.5);
+        }
+        f.geometry = line;
+        f.properties["index"] = static_cast<uint64_t>(i);
+        f.properties["name"] = "feature #" + std::to_string(i);
+        f.id = static_cast<int64_t>(i);
+        fc.push_back(std::move(f));
+    }
+    fc.custom_properties["answer"] = 42;
+    return fc;
+}
+
+TEST_CASE("streaming decode")
+{
+    auto inputs = std::vector<std::string>{
+        std::string(PROJECT_SOURCE_DIR "/data/sample1.json")};
+    for (auto &basename : FIXTURES) {
+        inputs.push_back(FIXTURES_DIR + std::string("/") + basename);
+    }
+    for (auto &input : inputs) {
+        auto bytes = mapbox::geobuf::Encoder().encode(
+            mapbox::geojson::convert(mapbox::geobuf::load_json(input)));
+        auto output = dbg(std::string{PROJECT_BINARY_DIR "/streaming.json"});
+        auto decoder = mapbox::geobuf::Decoder();
+        auto expected = mapbox::geobuf::geojson2json(decoder.decode(bytes));
+        CHECK(decoder.decode_to_json(bytes, output, true));
+        CHECK(mapbox::geobuf::load_json(output) == expected);
+        // all objects sorted
+        CHECK(decoder.decode_to_json(bytes, output, false, true));
+        auto sorted = mapbox::geobuf::load_json(output);
+        CHECK(sorted == expected);
+        CHECK(mapbox::geobuf::load_bytes(output) ==
+              mapbox::geobuf::dump(sorted, false, true));
+    }
+    // coordinates are written as fixed-point decimals
+    auto line = mapbox::geojson::line_string{{120.1, 0.3}, {120, -3.25}};
+    auto bytes = mapbox::geobuf::Encoder().encode(line);
+    auto output = std::string{PROJECT_BINARY_DIR "/streaming.json"};
+    CHECK(mapbox::geobuf::Decoder().decode_to_json(bytes, output));
+    CHECK(mapbox::geobuf::load_bytes(output) ==
+          R"({"type":"LineString","coordinates":[[120.1,0.3],[120.0,-3.25]]})");
+    // boundaries: smallest q, integral values, trailing zeros, |q| up to
+    // 10^15 (beyond that, Writer::Double)
+    auto points = mapbox::geojson::multi_point{{0.000001, -0.000001},
+                                               {120, 0},
+                                               {-3, 10.1},
+                                               {0.25, -1.5},
+                                               {999999999.999999, -1e9}};
+    bytes = mapbox::geobuf::Encoder().encode(points);
+    CHECK(mapbox::geobuf::Decoder().decode_to_json(bytes, output));
+    CHECK(mapbox::geobuf::load_bytes(output) ==
+          R"({"type":"MultiPoint","coordinates":[[0.000001,-0.000001],)"
+          R"([120.0,0.0],[-3.0,10.1],[0.25,-1.5],)"
+          R"([999999999.999999,-1000000000.0]]})");
+    // precision 8: fixed-point from 1e-6 on, below that Writer::Double
+    points = mapbox::geojson::multi_point{{0.00000001, 0.000001},
+                                          {1.5, -0.00000123}};
+    bytes = mapbox::geobuf::Encoder(100000000).encode(points);
+    CHECK(mapbox::geobuf::Decoder().decode_to_json(bytes, output));
+    CHECK(mapbox::geobuf::load_bytes(output) ==
+          R"({"type":"MultiPoint","coordinates":[[1e-8,0.000001],)"
+          R"([1.5,-0.00000123]]})");
+}
+
+TEST_CASE("mapped file")
+{
+    auto text = R"({"type":"FeatureCollection","features":[)"
+                R"({"type":"Feature","properties":{"name":"a"},)"
+                R"("geometry":{"type":"Point","coordinates":[1.5,-2.25]}}],)"
+                R"("answer":42})";
+    auto bytes = mapbox::geobuf::Encoder().encode(text);
+    auto path = std::string{PROJECT_BINARY_DIR "/mapped.pbf"};
+    CHECK(mapbox::geobuf::dump_bytes(path, bytes));
+    {
+        auto file = mapbox::geobuf::MappedFile(path);
+        REQUIRE(static_cast<bool>(file));
+        CHECK(std::string(file.data(), file.size()) == bytes);
+    }
+    CHECK(mapbox::geobuf::load_bytes(path) == bytes);
+    auto decoded = mapbox::geobuf::Decoder().decode_file(path);
+    auto &fc = decoded.get<mapbox::geojson::feature_collection>();
+    REQUIRE(fc.size() == 1);
+    CHECK(fc[0].properties.at("name").get<std::string>() == "a");
+    CHECK(fc[0].geometry ==
+          mapbox::geojson::geometry{mapbox::geojson::point{1.5, -2.25}});
+    CHECK(fc.custom_properties.at("answer").get<uint64_t>() == 42);
+    CHECK_THROWS(mapbox::geobuf::Decoder().decode_file(path + ".missing"));
+    CHECK(!mapbox::geobuf::MappedFile(path + ".missing"));
+}
+
+TEST_CASE("in-situ load")
+{
+    for (auto &basename : FIXTURES) {
+        auto input = std::string{FIXTURES_DIR + std::string("/") + basename};
+        auto json = mapbox::geobuf::load_json_insitu(input);
+        REQUIRE(json);
+        CHECK(*json == mapbox::geobuf::load_json(input));
+    }
+    // no room for the '\0' after a page-sized file, read into a buffer
+    auto text = mapbox::geobuf::dump(mapbox::geobuf::load_json(
+        std::string{FIXTURES_DIR + std::string("/props.json")}));
+    text.resize(1 << 16, ' ');
+    auto path = std::string{PROJECT_BINARY_DIR "/insitu.json"};
+    CHECK(mapbox::geobuf::dump_bytes(path, text));
+    CHECK(*mapbox::geobuf::load_json_insitu(path) ==
+          mapbox::geobuf::load_json(path));
+    CHECK(mapbox::geobuf::load_json_insitu(path + ".missing")->IsNull());
+}
+
+TEST_CASE("parallel encode")
+{
+    auto fc = sample_features(5000);
+    auto expected = mapbox::geobuf::Encoder().encode(fc);
+    for (int threads : {2, 3, 8}) {
+        auto encoder = mapbox::geobuf::Encoder(
+            std::pow(10, MAPBOX_GEOBUF_DEFAULT_PRECISION), threads);
+        auto bytes = encoder.encode(fc);
+        CHECK(bytes == expected);
+        // a feature from the middle of some chunk, spelled out
+        auto decoded = mapbox::geobuf::Decoder().decode(bytes);
+        auto &f = decoded.get<mapbox::geojson::feature_collection>()[4321];
+        CHECK(f.id.get<int64_t>() == 4321);
+        CHECK(f.properties.at("index").get<uint64_t>() == 4321);
+        CHECK(f.properties.at("name").get<std::string>() == "feature #4321");
+        auto &line = f.geometry.get<mapbox::geojson::line_string>();
+        REQUIRE(line.size() == 10);
+        CHECK(line[0] == mapbox::geojson::point{120.4321, 30.0, 1.5});
+        CHECK(line[9] == mapbox::geojson::point{120.43219, 30.009, 0.0});
+    }
+}
+
+TEST_CASE("parallel analyze")
+{
+    mapbox::geojson::feature_collection fc;
+    for (int i = 0; i < 4000; ++i) {
+        mapbox::geojson::feature f;
+        f.geometry = mapbox::geojson::point(120 + i % 7, 30);
+        f.properties["key" + std::to_string(i % 13)] = i;
+        fc.push_back(std::move(f));
+    }
+    // only the last chunk needs xyz and a finer precision
+    fc.back().geometry = mapbox::geojson::point(120.12345, 30.5, 7.25);
+    fc.back().properties["last"] = true;
+    auto expected = mapbox::geobuf::Encoder().encode(fc);
+    auto encoder = mapbox::geobuf::Encoder(
+        std::pow(10, MAPBOX_GEOBUF_DEFAULT_PRECISION), 4);
+    CHECK(encoder.encode(fc) == expected);
+    auto decoded = mapbox::geobuf::Decoder().decode(expected);
+    auto &last = decoded.get<mapbox::geojson::feature_collection>().back();
+    CHECK(last.geometry.get<mapbox::geojson::point>().z == 7.25);
+}
+
+TEST_CASE("parallel decode")
+{
+    auto bytes = mapbox::geobuf::Encoder().encode(sample_features(5000));
+    for (int threads : {2, 3, 8}) {
+        auto decoded = mapbox::geobuf::Decoder(threads).decode(bytes);
+        auto &fc = decoded.get<mapbox::geojson::feature_collection>();
+        REQUIRE(fc.size() == 5000);
+        // features in order, custom properties kept
+        for (int i : {0, 255, 256, 2500, 4999}) {
+            CHECK(fc[i].id.get<int64_t>() == i);
+            CHECK(fc[i].properties.at("name").get<std::string>() ==
+                  "feature #" + std::to_string(i));
+        }
+        auto &line = fc[2500].geometry.get<mapbox::geojson::line_string>();
+        CHECK(line[1] == mapbox::geojson::point{120.25001, 30.001, 0.0});
+        CHECK(fc.custom_properties.at("answer").get<int64_t>() == 42);
+        CHECK(mapbox::geobuf::Encoder().encode(decoded) == bytes);
+    }
+}
+
+TEST_CASE("quantize kernel")
+{
+    // halfway values, negatives, and a tail that's not a multiple of 4
+    std::vector<double> xyz;
+    for (int i = 0; i < 37; ++i) {
+        xyz.push_back(120.0000005 * (i % 2 ? -1 : 1) + i * 0.0000015);
+        xyz.push_back(-0.5e-6 * i);
+        xyz.push_back(i * 0.25);
+    }
+    for (int dim : {2, 3}) {
+        for (double e : {1.0, 1e6, 1e7}) {
+            for (size_t n : {0, 1, 2, 3, 5, 37}) {
+                std::vector<uint64_t> expected;
+                int64_t q_prev[3] = {0, 0, 0};
+                for (size_t i = 0; i < n; ++i) {
+                    for (int d = 0; d < dim; ++d) {
+                        auto q = static_cast<int64_t>(
+                            std::round(xyz[i * 3 + d] * e));
+                        auto delta = q - q_prev[d];
+                        expected.push_back((static_cast<uint64_t>(delta) << 1) ^
+                                           static_cast<uint64_t>(delta >> 63));
+                        q_prev[d] = q;
+                    }
+                }
+                std::vector<uint64_t> actual(n * dim);
+                int64_t last[3] = {0, 0, 0};
+                mapbox::geobuf::kernels::quantize_delta_zigzag(
+                    xyz.data(), n, dim, e, last, actual.data());
+                CHECK(actual == expected);
+                // same output when fed in blocks of 2 points
+                std::vector<uint64_t> blocks(n * dim);
+                int64_t prev[3] = {0, 0, 0};
+                for (size_t i = 0; i < n; i += 2) {
+                    mapbox::geobuf::kernels::quantize_delta_zigzag(
+                        &xyz[i * 3], std::min(n - i, size_t(2)), dim, e, prev,
+                        &blocks[i * dim]);
+                }
+                CHECK(blocks == expected);
+                CHECK(std::equal(prev, prev + dim, last));
+            }
+        }
+    }
+}
+
+TEST_CASE("decode kernel")
+{
+    for (int dim : {2, 3}) {
+        // short and long (up to 10 bytes) varints, words hold 0 to 8 of them
+        std::vector<int64_t> deltas;
+        for (int i = 0; i < 600; ++i) {
+            int64_t delta = (i * 7919) % 300 - 150;
+            if (i % 17 == 0) {
+                delta *= 1000000007;
+            }
+            if (i % 101 == 0) {
+                delta = int64_t(1) << 62;
+            } else if (i % 101 == dim) {
+                delta = -(int64_t(1) << 62); // back for the same coordinate
+            }
+            deltas.push_back(delta);
+        }
+        std::string bytes;
+        for (auto delta : deltas) {
+            protozero::add_varint_to_buffer(&bytes,
+                                            protozero::encode_zigzag64(delta));
+        }
+        const size_t n = deltas.size() / dim;
+        for (double e : {1.0, 1e6}) {
+            std::vector<double> expected(n * 3, -1.0);
+            int64_t sum[3] = {0, 0, 0};
+            for (size_t i = 0; i < n * dim; ++i) {
+                sum[i % dim] += deltas[i];
+                expected[i / dim * 3 + i % dim] = sum[i % dim] / e;
+            }
+            const char *begin = bytes.data();
+            const char *end = begin + bytes.size();
+            std::vector<double> actual(n * 3, -1.0);
+            int64_t last[3] = {0, 0, 0};
+            CHECK(mapbox::geobuf::kernels::decode_delta_zigzag(
+                      begin, end, n, dim, e, last, actual.data()) == end);
+            CHECK(actual == expected);
+            // same output when fed in blocks of 3 points
+            std::vector<double> blocks(n * 3, -1.0);
+            int64_t prev[3] = {0, 0, 0};
+            const char *data = begin;
+            for (size_t i = 0; i < n; i += 3) {
+                data = mapbox::geobuf::kernels::decode_delta_zigzag(
+                    data, end, std::min(n - i, size_t(3)), dim, e, prev,
+                    &blocks[i * 3]);
+            }
+            CHECK(data == end);
+            CHECK(blocks == expected);
+            CHECK(std::equal(prev, prev + dim, last));
+            // stops early at the end of the data, throws mid point
+            std::vector<double> more((n + 5) * 3);
+            int64_t zeros[3] = {0, 0, 0};
+            CHECK(mapbox::geobuf::kernels::decode_delta_zigzag(
+                      begin, end, n + 5, dim, e, zeros, more.data()) == end);
+            CHECK_THROWS_AS(mapbox::geobuf::kernels::decode_delta_zigzag(
+                                begin, end - 1, n, dim, e, zeros, more.data()),
+                            protozero::end_of_buffer_exception);
+        }
+    }
+}
+
+TEST_CASE("no allocations per feature")
+{
+    auto encoder = mapbox::geobuf::Encoder();
+    auto count_allocations = [&](int n) {
+        // encode(feature_collection) would copy it into a geojson
+        auto geojson = mapbox::geojson::geojson{sample_features(n)};
+        encoder.encode(geojson); // warm up scratch buffers
+        size_t before = num_allocations;
+        auto bytes = encoder.encode(geojson);
+        return num_allocations - before;
+    };
+    // only the output buffer grows (geometrically), the key table and the
+    // header allocate per encode, not per feature
+    auto small = count_allocations(1000);
+    auto large = count_allocations(10000);
+    CHECK(large - small < 16);
+}
+
+TEST_CASE("presized submessages")
+{
+    // long strings and coordinate streams need multi-byte lengths
+    std::string long_name(300, 'x');
+    std::string ring = "[0,0]";
+    for (int i = 1; i < 100; ++i) {
+        ring += ",[" + std::to_string(i * 0.001) + "," +
+                std::to_string(i % 7 * 0.5) + "]";
+    }
+    ring += ",[0,0]";
+    auto text = R"({"type":"FeatureCollection","features":[)"
+                R"({"type":"Feature","id":"a","properties":{"name":")" +
+                long_name + R"("},"geometry":{"type":"Point","coordinates":[1,2,3]}},)"
+                R"({"type":"Feature","id":-5,"properties":{"count":-7},)"
+                R"("geometry":{"type":"MultiPolygon","coordinates":[[[)" +
+                ring + R"(],[[0,0],[1,0],[1,1],[0,0]]],[[)" + ring +
+                R"(]]]}},)"
+                R"({"type":"Feature","properties":{"list":[1,2,{"k":null}]},)"
+                R"("geometry":{"type":"GeometryCollection","geometries":[)"
+                R"({"type":"LineString","coordinates":[)" +
+                ring +
+                R"(]},{"type":"MultiLineString","coordinates":[[[1,2],[3,4]]]}]}},)"
+                R"({"type":"Feature","properties":{"ok":true},"geometry":null}],)"
+                R"("answer":4.5})";
+    auto bytes = mapbox::geobuf::Encoder().encode(text);
+    auto decoded = mapbox::geobuf::Decoder().decode(bytes);
+    auto &fc = decoded.get<mapbox::geojson::feature_collection>();
+    REQUIRE(fc.size() == 4);
+    CHECK(fc[0].properties["name"].get<std::string>() == long_name);
+    CHECK(fc[0].geometry.get<mapbox::geojson::point>().z == 3.0);
+    // sizes are exact, so decoding then encoding is byte-identical
+    CHECK(mapbox::geobuf::Encoder().encode(decoded) == bytes);
+}
+
+TEST_CASE("geobuf reader")
+{
+    auto fc = sample_features(1000);
+    auto bytes = mapbox::geobuf::Encoder().encode(fc);
+    auto reader = mapbox::geobuf::GeobufReader(bytes);
+    CHECK(reader.size() == 1000);
+    CHECK(reader.dim() == 3);
+    CHECK(reader.custom_properties().size() == 1);
+    CHECK(reader.custom_properties().at("answer").get<int64_t>() == 42);
+    auto f = reader.feature(777);
+    CHECK(f.id.get<int64_t>() == 777);
+    CHECK(f.properties.size() == 2);
+    CHECK(f.properties.at("index").get<uint64_t>() == 777);
+    CHECK(f.properties.at("name").get<std::string>() == "feature #777");
+    auto &line = f.geometry.get<mapbox::geojson::line_string>();
+    REQUIRE(line.size() == 10);
+    CHECK(line[0] == mapbox::geojson::point{120.0777, 30.0, 1.5});
+    CHECK(line[9] == mapbox::geojson::point{120.07779, 30.009, 0.0});
+    CHECK(reader.geometry(777) == f.geometry);
+    CHECK(reader.properties(777) == f.properties);
+    CHECK(reader.properties(0).at("name").get<std::string>() == "feature #0");
+    CHECK(reader.properties(999).at("index").get<uint64_t>() == 999);
+    CHECK_THROWS_AS(reader.feature(1000), std::out_of_range);
+}
+
+TEST_CASE("projection")
+{
+    using namespace mapbox::geojson;
+    feature_collection fc;
+    for (int i = 0; i < 3; ++i) {
+        feature f;
+        f.geometry = line_string{{i + 0.5, 1.0}, {i + 1.5, 2.0}};
+        f.id = int64_t(i);
+        f.properties["a"] = uint64_t(i);
+        f.properties["b"] = std::string(i, 'x');
+        f.properties["c"] = value::array_type{uint64_t(1), uint64_t(2)};
+        f.custom_properties["extra"] = true;
+        fc.push_back(std::move(f));
+    }
+    fc.custom_properties["answer"] = uint64_t(42);
+    auto bytes = mapbox::geobuf::Encoder().encode(fc);
+    auto decoder = mapbox::geobuf::Decoder();
+    // one property (and a missing one), no geometry
+    decoder.set_projection(std::vector<std::string>{"b", "missing"}, false);
+    auto projected = decoder.decode(bytes);
+    auto &kept = projected.get<feature_collection>();
+    REQUIRE(kept.size() == 3);
+    for (int i = 0; i < 3; ++i) {
+        CHECK(kept[i].id.get<int64_t>() == i);
+        CHECK(kept[i].geometry.is<empty>());
+        CHECK(kept[i].properties ==
+              mapbox::feature::property_map{{"b", std::string(i, 'x')}});
+        // custom properties are always decoded
+        CHECK(kept[i].custom_properties ==
+              mapbox::feature::property_map{{"extra", true}});
+    }
+    CHECK(kept.custom_properties ==
+          mapbox::feature::property_map{{"answer", uint64_t(42)}});
+    // geometry only
+    decoder.set_projection(std::vector<std::string>{});
+    size_t count = 0;
+    CHECK(decoder.decode(bytes, [&](feature &f) {
+        CHECK(f.properties.empty());
+        CHECK(f.geometry == geometry{line_string{{count + 0.5, 1.0},
+                                                 {count + 1.5, 2.0}}});
+        return ++count < 2;
+    }) == false);
+    CHECK(count == 2);
+    // everything
+    decoder.set_projection(std::nullopt);
+    CHECK(decoder.decode(bytes) == geojson{fc});
+}
+
+TEST_CASE("projected decode to file")
+{
+    auto text = R"({"type":"Feature","properties":{"a":1,"b":"x","c":[1,2]},)"
+                R"("geometry":{"type":"Point","coordinates":[1.5,2.5]},)"
+                R"("extra":true})";
+    auto input = std::string{PROJECT_BINARY_DIR "/projected.pbf"};
+    auto output = std::string{PROJECT_BINARY_DIR "/projected.json"};
+    CHECK(mapbox::geobuf::dump_bytes(
+        input, mapbox::geobuf::Encoder().encode(std::string{text})));
+    auto decoder = mapbox::geobuf::Decoder();
+    decoder.set_projection(std::vector<std::string>{"b"}, false);
+    CHECK(decoder.decode(input, output, false, true));
+    CHECK(mapbox::geobuf::load_bytes(output) ==
+          R"({"extra":true,"geometry":null,"properties":{"b":"x"},)"
+          R"("type":"Feature"})");
+    // geometry kept, no properties
+    decoder.set_projection(std::vector<std::string>{});
+    CHECK(decoder.decode(input, output, false, true));
+    CHECK(mapbox::geobuf::load_bytes(output) ==
+          R"({"extra":true,"geometry":{"coordinates":[1.5,2.5],)"
+          R"("type":"Point"},"properties":{},"type":"Feature"})");
+}
+
+TEST_CASE("bbox decode")
+{
+    mapbox::geojson::feature_collection fc;
+    for (int i = 0; i < 10; ++i) {
+        mapbox::geojson::feature f;
+        // a polygon with a hole, rings restart their deltas
+        mapbox::geojson::polygon polygon;
+        polygon.push_back(
+            {{i + 0.0, 0.0}, {i + 0.5, 0.0}, {i + 0.5, 0.5}, {i + 0.0, 0.0}});
+        polygon.push_back(
+            {{i + 0.1, 0.1}, {i + 0.2, 0.1}, {i + 0.2, 0.2}, {i + 0.1, 0.1}});
+        f.geometry = polygon;
+        f.properties["index"] = static_cast<uint64_t>(i);
+        fc.push_back(std::move(f));
+    }
+    fc.push_back(mapbox::geojson::feature{}); // no geometry
+    auto bytes = mapbox::geobuf::Encoder().encode(fc);
+    auto decoder = mapbox::geobuf::Decoder();
+    auto inside = decoder.decode(bytes, std::array<double, 4>{2.4, -1, 4.5, 1});
+    REQUIRE(inside.size() == 3);
+    CHECK(inside[0] == fc[2]);
+    CHECK(inside[1] == fc[3]);
+    CHECK(inside[2] == fc[4]);
+    // touching counts
+    CHECK(decoder.decode(bytes, std::array<double, 4>{9.5, 0.5, 20, 20})
+              .size() == 1);
+    CHECK(decoder.decode(bytes, std::array<double, 4>{20, 20, 30, 30})
+              .empty());
+    // single feature
+    bytes = mapbox::geobuf::Encoder().encode(fc[7]);
+    CHECK(decoder.decode(bytes, std::array<double, 4>{7, 0, 8, 1}).size() == 1);
+    CHECK(decoder.decode(bytes, std::array<double, 4>{0, 0, 1, 1}).empty());
+}
+
+TEST_CASE("visitor decode")
+{
+    using namespace mapbox::geojson;
+    // geometries of different types and sizes one after the other, the
+    // reused feature must not keep anything from the previous one
+    feature_collection fc;
+    auto add = [&](geometry g, const std::string &name) {
+        feature f;
+        f.geometry = std::move(g);
+        f.properties["name"] = name;
+        fc.push_back(std::move(f));
+    };
+    add(line_string{{0, 0}, {1, 1}, {2, 0.5}}, "line3");
+    add(line_string{{5, 5}, {6, 6}}, "line2");
+    add(point{1.5, 2.5}, "point");
+    add(multi_polygon{{{{0, 0}, {1, 0}, {1, 1}, {0, 0}}},
+                      {{{2, 2}, {3, 2}, {3, 3}, {2, 2}},
+                       {{2.25, 2.25}, {2.5, 2.25}, {2.5, 2.5}, {2.25, 2.25}}}},
+        "polygons");
+    add(multi_polygon{{{{4, 4}, {5, 4}, {5, 5}, {4, 4}}}}, "polygon");
+    add(geometry{}, "nothing");
+    add(line_string{{7, 7}, {8, 8}}, "line");
+    fc[6].properties.erase("name");
+    fc[6].id = int64_t(7);
+
+    auto bytes = mapbox::geobuf::Encoder().encode(fc);
+    auto decoder = mapbox::geobuf::Decoder();
+    size_t count = 0;
+    CHECK(decoder.decode(bytes, [&](feature &f) {
+        CHECK(f == fc[count++]);
+        return true;
+    }));
+    CHECK(count == fc.size());
+    // stop early
+    count = 0;
+    CHECK(!decoder.decode(bytes, [&](feature &f) { return ++count < 3; }));
+    CHECK(count == 3);
+    // a single feature
+    bytes = mapbox::geobuf::Encoder().encode(fc[3]);
+    CHECK(decoder.decode(bytes, [&](feature &f) {
+        CHECK(f == fc[3]);
+        return true;
+    }));
+}
@@ -11,6 +11,7 @@ import pybind11_geobuf
 from pybind11_geobuf import (  # noqa
     Decoder,
     Encoder,
+    GeobufReader,
     geojson,
     pbf_decode,
     rapidjson,
@@ -389,3 +390,497 @@ def test_geobuf_from_geojson():
     encoded1 = encoder.encode(rapidjson(feature))
     assert len(encoded1) == len(encoded)
     # geojson.Feature().from_rapidjson
+
+
+def test_geobuf_encode_threads():
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "properties": {"index": i},
+                "geometry": {
+                    "type": "Point",
+                    "coordinates": [120.0 + i * 1e-4, 30.0],
+                },
+            }
+            for i in range(2000)
+        ],
+    }
+    expected = Encoder().encode(features)
+    assert Encoder(threads=4).encode(features) == expected
+    assert Decoder(threads=4).decode(expected) == Decoder().decode(expected)
+
+
+def test_geobuf_reader():
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "properties": {"index": i, "name": f"#{i}"},
+                "geometry": {
+                    "type": "LineString",
+                    "coordinates": [[120.0 + i * 1e-4, 30.0], [121.0, 31.0]],
+                },
+            }
+            for i in range(100)
+        ],
+        "answer": 42,
+    }
+    encoded = Encoder().encode(features)
+    reader = GeobufReader(encoded)
+    assert len(reader) == reader.size() == 100
+    assert reader.dim() == 2
+    assert reader.custom_properties()["answer"]() == 42
+    fc = Decoder().decode_to_geojson(encoded).as_feature_collection()
+    for i in [0, 42, 99]:
+        assert reader.feature(i) == fc[i]
+        assert reader.geometry(i) == fc[i].geometry()
+        assert reader.properties(i)["name"]() == f"#{i}"
+    with pytest.raises(IndexError):
+        reader.feature(100)
+
+
+def test_geobuf_iter_features():
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "properties": {"index": i},
+                "geometry": {"type": "Point", "coordinates": [120.0, 30.0 + i]},
+            }
+            for i in range(10)
+        ],
+    }
+    encoded = Encoder().encode(features)
+    fc = Decoder().decode_to_geojson(encoded).as_feature_collection()
+    iterated = list(Decoder().iter_features(encoded))
+    assert len(iterated) == 10
+    assert all(a == b for a, b in zip(iterated, fc))
+    # straight from the buffer, with the decoder's projection
+    decoder = Decoder()
+    decoder.set_projection([], geometry=False)
+    stream = decoder.iter_features(memoryview(bytearray(encoded)))
+    decoder.set_projection(None)  # too late for the stream
+    f = next(stream)
+    assert len(f.properties()) == 0
+    assert f.geometry().type() == "None"
+    assert len(list(stream)) == 9
+    # a single feature
+    single = Encoder().encode(features["features"][3])
+    iterated = Decoder().iter_features(single)
+    assert [f.properties()["index"]() for f in iterated] == [3]
+    assert [f.properties()["index"]() for f in GeobufReader(encoded)] == list(
+        range(10)
+    )
+
+
+def test_geobuf_projection():
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "properties": {"index": i, "name": f"#{i}", "flag": i % 2 == 0},
+                "geometry": {"type": "Point", "coordinates": [120.0, 30.0 + i]},
+            }
+            for i in range(10)
+        ],
+    }
+    encoded = Encoder().encode(features)
+    decoder = Decoder()
+    decoder.set_projection(["name"], geometry=False)
+    decoded = json.loads(decoder.decode(encoded))
+    assert [f["properties"] for f in decoded["features"]] == [
+        {"name": f"#{i}"} for i in range(10)
+    ]
+    assert all(not f.get("geometry") for f in decoded["features"])
+    decoder.set_projection()
+    assert decoder.decode(encoded) == Decoder().decode(encoded)
+
+
+def test_geobuf_decode_bbox():
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "properties": {"index": i},
+                "geometry": {
+                    "type": "LineString",
+                    "coordinates": [[120.0 + i, 30.0], [120.5 + i, 30.5]],
+                },
+            }
+            for i in range(10)
+        ],
+    }
+    encoded = Encoder().encode(features)
+    fc = Decoder().decode_to_geojson(encoded, bbox=[122.6, 30.2, 124.0, 31.0])
+    fc = fc.as_feature_collection()
+    assert [f.properties()["index"]() for f in fc] == [3, 4]
+
+
+def test_geobuf_decode_file(tmp_path):
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "properties": {"index": i},
+                "geometry": {"type": "Point", "coordinates": [120.0, 30.0 + i]},
+            }
+            for i in range(10)
+        ],
+    }
+    encoded = Encoder().encode(features)
+    path = str(tmp_path / "features.pbf")
+    with open(path, "wb") as f:
+        f.write(encoded)
+    decoder = Decoder()
+    assert decoder.decode_file(path) == decoder.decode_to_geojson(encoded)
+    with pytest.raises(RuntimeError):
+        decoder.decode_file(path + ".missing")
+
+
+def test_geobuf_buffers():
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "properties": {"index": i},
+                "geometry": {"type": "Point", "coordinates": [120.0, 30.0 + i]},
+            }
+            for i in range(10)
+        ],
+    }
+    encoded = Encoder().encode(features)
+    buffer = Encoder().encode(features, copy=False)
+    assert not isinstance(buffer, bytes)
+    assert len(buffer) == len(encoded)
+    assert buffer == encoded
+    assert bytes(buffer) == encoded
+    assert bytes(memoryview(buffer)) == encoded
+
+    expected = Decoder().decode(encoded)
+    array = np.frombuffer(encoded, dtype=np.uint8)
+    for geobuf in [buffer, memoryview(encoded), bytearray(encoded), array]:
+        assert Decoder().decode(geobuf) == expected
+        assert pbf_decode(geobuf) == pbf_decode(encoded)
+        assert len(GeobufReader(geobuf)) == 10
+    with pytest.raises(ValueError):
+        Decoder().decode(np.frombuffer(encoded * 2, dtype=np.uint8)[::2])
+
+    # str still accepted (its UTF-8 bytes), so only an ASCII geobuf here
+    encoded = Encoder().encode(
+        {
+            "type": "Feature",
+            "properties": {"name": "ascii"},
+            "geometry": {"type": "Point", "coordinates": [1, 2]},
+        }
+    )
+    assert encoded.isascii()
+    text = encoded.decode("ascii")
+    decoder = Decoder()
+    assert decoder.decode(text) == decoder.decode(encoded)
+    assert decoder.decode_to_geojson(text) == decoder.decode_to_geojson(encoded)
+    assert pbf_decode(text) == pbf_decode(encoded)
+    with pytest.raises(TypeError):
+        decoder.decode(42)
+
+
+def test_geobuf_shared_across_threads():
+    from concurrent.futures import ThreadPoolExecutor
+
+    # every input has its own keys and dim: calls interleaving on the shared
+    # encoder/decoder would mix them up
+    def feature_collection(i):
+        return {
+            "type": "FeatureCollection",
+            "features": [
+                {
+                    "type": "Feature",
+                    "properties": {f"key{i}": j, f"name{i}": f"#{j}"},
+                    "geometry": {
+                        "type": "LineString",
+                        "coordinates": [
+                            [120.0 + k * 1e-3, 30.0 + j * 1e-3] + [i] * (i % 2)
+                            for k in range(20)
+                        ],
+                    },
+                }
+                for j in range(300)
+            ],
+        }
+
+    inputs = [feature_collection(i) for i in range(16)]
+    encoded = [Encoder().encode(fc) for fc in inputs]
+    decoded = [Decoder().decode(pbf) for pbf in encoded]
+
+    encoder = Encoder()
+    decoder = Decoder()
+
+    def work(i):
+        pbf = encoder.encode(inputs[i])
+        return pbf, decoder.decode(pbf)
+
+    with ThreadPoolExecutor(max_workers=8) as executor:
+        results = list(executor.map(work, range(len(inputs))))
+    assert [pbf for pbf, _ in results] == encoded
+    assert [text for _, text in results] == decoded
+
+
+def test_geobuf_encode_decode_many():
+    features = [
+        {
+            "type": "Feature",
+            "properties": {"index": i},
+            "geometry": {"type": "Point", "coordinates": [120.0, 30.0 + i]},
+        }
+        for i in range(100)
+    ]
+    expected = [Encoder().encode(f) for f in features]
+    inputs = [
+        features[0],
+        json.dumps(features[1]),
+        Decoder().decode_to_geojson(expected[2]),
+        Decoder().decode_to_geojson(expected[3]).as_feature(),
+        *features[4:],
+    ]
+    for threads in [1, 4]:
+        encoded = Encoder(threads=threads).encode_many(inputs)
+        assert encoded == expected
+        decoded = Decoder(threads=threads).decode_many(encoded)
+        assert decoded == [Decoder().decode_to_geojson(e) for e in expected]
+    buffers = Encoder(threads=4).encode_many(features, copy=False)
+    assert [bytes(b) for b in buffers] == expected
+    assert Decoder(threads=4).decode_many(buffers) == decoded
+    assert Encoder(threads=4).encode_many([]) == []
+
+
+def test_geobuf_decode_to_python():
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            {
+                "type": "Feature",
+                "id": i,
+                "properties": {
+                    "index": i,
+                    "name": f"feature #{i}",
+                    "tags": ["a", {"b": 1.5}],
+                    "flag": i % 2 == 0,
+                    "none": None,
+                },
+                "geometry": {
+                    "type": "LineString",
+                    "coordinates": [[120.0 + j * 1e-3, 30.0, -1.5] for j in range(5)],
+                },
+                "my_key": "custom",
+            }
+            for i in range(10)
+        ],
+    }
+    features["features"].append(
+        {
+            "type": "Feature",
+            "properties": {},
+            "geometry": {
+                "type": "GeometryCollection",
+                "geometries": [
+                    {"type": "Point", "coordinates": [1.0, 2.0]},
+                    {
+                        "type": "MultiPolygon",
+                        "coordinates": [[[[0, 0], [1, 0], [1, 1], [0, 0]]]],
+                    },
+                ],
+            },
+        }
+    )
+    encoded = Encoder(max_precision=int(10**8)).encode(features)
+    decoder = Decoder()
+    decoded = decoder.decode_to_python(encoded)
+    assert decoded == json.loads(decoder.decode(encoded))
+    assert list(decoded["features"][0].keys()) == list(
+        json.loads(decoder.decode(encoded))["features"][0].keys()
+    )
+    assert decoder.decode_to_python(Encoder().encode(features["features"][0])) == (
+        json.loads(Decoder().decode(Encoder().encode(features["features"][0])))
+    )
+
+    # projected like decode
+    decoder.set_projection(["index"], geometry=False)
+    projected = decoder.decode_to_python(encoded)
+    assert projected == json.loads(decoder.decode(encoded))
+    f = projected["features"][3]
+    assert f["properties"] == {"index": 3}
+    assert f["geometry"] is None
+    assert f["my_key"] == "custom"
+
+
+def test_geobuf_encode_python_objects():
+    def feature(geometry, **kwargs):
+        return {"type": "Feature", "geometry": geometry, **kwargs}
+
+    features = {
+        "type": "FeatureCollection",
+        "features": [
+            feature(
+                {"type": "Point", "coordinates": [120.1, 30.2, 5]},
+                id=1,
+                properties={
+                    "int": -3,
+                    "uint": 2**63 + 1,
+                    "float": 1.5,
+                    "bool": True,
+                    "none": None,
+                    "list": [1, "a", {"b": [False]}],
+                },
+            ),
+            feature(
+                {"type": "MultiPoint", "coordinates": [[1, 2], [3, 4]]},
+                id="two",
+                properties=None,
+            ),
+            feature(
+                {"type": "LineString", "coordinates": [[1, 2, 3], [4, 5, 6]]},
+                id=-3,
+                my_key={"nested": 1},
+                properties={},
+            ),
+            feature(
+                {
+                    "type": "MultiLineString",
+                    "coordinates": [[[1, 2], [3, 4]], [[5, 6], [7, 8]]],
+                    "custom": "geometry",
+                },
+                id=4.5,
+                properties={},
+            ),
+            feature(
+                {
+                    "type": "Polygon",
+                    "coordinates": [[[0, 0], [1, 0], [1, 1], [0, 0]]],
+                },
+                properties={},
+            ),
+            feature(
+                {
+                    "type": "MultiPolygon",
+                    "coordinates": [[[[0, 0], [1, 0], [1, 1], [0, 0]]]],
+                },
+                properties={},
+            ),
+            feature(
+                {
+                    "type": "GeometryCollection",
+                    "geometries": [
+                        {"type": "Point", "coordinates": [1, 2]},
+                        {"type": "LineString", "coordinates": [[1, 2], [3, 4]]},
+                    ],
+                },
+                properties={},
+            ),
+            feature(None, properties={}),
+        ],
+        "fc_key": [1, 2],
+    }
+    encoder = Encoder(max_precision=int(10**8))
+    expected = encoder.encode(json.dumps(features))
+    assert encoder.encode(features) == expected
+    for f in features["features"]:
+        assert encoder.encode(f) == encoder.encode(json.dumps(f))
+        if f["geometry"]:
+            g = f["geometry"]
+            assert encoder.encode(g) == encoder.encode(json.dumps(g))
+
+    # numpy arrays as coordinates
+    line = [[120.0 + i * 1e-3, 30.0, i * 0.5] for i in range(10)]
+    expected = encoder.encode({"type": "LineString", "coordinates": line})
+    coords = np.array(line)
+    assert encoder.encode({"type": "LineString", "coordinates": coords}) == expected
+    polygon = {"type": "Polygon", "coordinates": [line[:3] + line[:1]]}
+    expected = encoder.encode(polygon)
+    polygon["coordinates"] = np.array(polygon["coordinates"])
+    assert encoder.encode(polygon) == expected
+    point = {"type": "Point", "coordinates": np.array([1.0, 2.0])}
+    assert encoder.encode(point) == encoder.encode(
+        {"type": "Point", "coordinates": [1.0, 2.0]}
+    )
+
+    with pytest.raises(Exception):  # noqa: B017
+        encoder.encode({"type": "Point", "coordinates": [1.0]})
+
+    # no "geometry" key: same as the JSON path, whatever that does
+    def outcome(geojson):
+        try:
+            return encoder.encode(geojson)
+        except Exception as e:
+            return type(e)
+
+    f = {"type": "Feature", "properties": {"a": 1}}
+    assert outcome(f) == outcome(json.dumps(f))
+    fc = {"type": "FeatureCollection", "features": [f]}
+    assert outcome(fc) == outcome(json.dumps(fc))
+
+
+def test_geojson_pickle():
+    ring = [
+        [0.1 + 0.2, 1 / 3, 7.0],
+        [1e-300, -2.5, 0.0],
+        [123.456789012345, 0, 1],
+    ]
+    geometries = [
+        {"type": "Point", "coordinates": ring[0]},
+        {"type": "MultiPoint", "coordinates": ring},
+        {"type": "LineString", "coordinates": ring},
+        {"type": "MultiLineString", "coordinates": [ring, ring[:2], []]},
+        {"type": "Polygon", "coordinates": [ring + ring[:1], []]},
+        {"type": "MultiPolygon", "coordinates": [[ring + ring[:1]], [], [[]]]},
+        {
+            "type": "GeometryCollection",
+            "geometries": [
+                {"type": "Point", "coordinates": [1, 2]},
+                {"type": "LineString", "coordinates": ring},
+            ],
+        },
+    ]
+    for geometry in geometries:
+        g = geojson.Geometry().from_rapidjson(rapidjson(geometry))
+        g2 = pickle.loads(pickle.dumps(g))
+        assert g2 == g
+        assert g2() == g()
+        t = g2.type()
+        if t != "GeometryCollection":
+            typed = getattr(g, "as_" + geojson_snake_case(t))()
+            assert pickle.loads(pickle.dumps(typed)) == typed
+
+    g = geojson.Geometry().from_rapidjson(rapidjson(geometries[0]))
+    g["custom"] = {"key": [1, "two"]}
+    g2 = pickle.loads(pickle.dumps(g))
+    assert g2["custom"]() == {"key": [1, "two"]}
+    assert g2() == g()
+
+    # versioned, little-endian doubles/uint64
+    g = geojson.Geometry().from_rapidjson(
+        rapidjson({"type": "MultiLineString", "coordinates": [[[1, 2], [3, 4, 5]]]})
+    )
+    version, type, xyz, lengths, children, custom = g.__getstate__()
+    assert (version, type, children, custom) == (1, "MultiLineString", None, None)
+    assert np.frombuffer(xyz, dtype="<f8").tolist() == [1, 2, 0, 3, 4, 5]
+    assert np.frombuffer(lengths, dtype="<u8").tolist() == [2]
+    g2 = geojson.Geometry.__new__(geojson.Geometry)
+    with pytest.raises(RuntimeError, match="format version"):
+        g2.__setstate__((2, type, xyz, lengths, children, custom))
+
+    # raw doubles, smaller than GeoJSON-like dicts
+    line = [[120.0 + i * 1e-5, 30.0 + i * 1e-5, 0.0] for i in range(1000)]
+    g = geojson.LineString(np.array(line))
+    assert pickle.loads(pickle.dumps(g)) == g
+    assert len(pickle.dumps(g)) < len(pickle.dumps(g.__geo_interface__))
+
+
+def geojson_snake_case(name):
+    return "".join("_" + c.lower() if c.isupper() else c for c in name).lstrip("_")